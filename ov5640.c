@@ -14,8 +14,21 @@
  */
 
 #include <linux/slab.h>
+#include <linux/bitmap.h>
 #include <linux/i2c.h>
 #include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/ratelimit.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/seqlock.h>
+#include <linux/firmware.h>
+#include <linux/crc32.h>
+#include <linux/gcd.h>
 #include <linux/version.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-subdev.h>
@@ -27,12 +40,126 @@
 
 #include "s5k4ba.h"
 
+#define CREATE_TRACE_POINTS
+#include "ov5640_trace.h"
+
+/* upper bound for the background AF firmware upload seen by AF requests */
+#define OV5640_AF_FW_TIMEOUT_MS		2000
+
+/* AF MCU mailbox: command 0x3022, 0x3023 cleared once it is taken */
+#define OV5640_AF_CMD_SINGLE		0x03
+#define OV5640_AF_CMD_CONTINUOUS	0x04
+#define OV5640_AF_CMD_PAUSE		0x06
+#define OV5640_AF_CMD_RELEASE		0x08
+#define OV5640_AF_CMD_DEFAULT_ZONE	0x80
+#define OV5640_AF_CMD_TOUCH_ZONE	0x81
+
+#define OV5640_REG_CHIP_ID		0x300a	/* and 0x300b */
+#define OV5640_REG_REVISION		0x302a
+#define OV5640_CHIP_ID			0x5640
+
+/* AF firmware status 0x3029 reads 0x7e/0x7f while the MCU boots */
+#define OV5640_REG_AF_FW_STATUS		0x3029
+#define OV5640_AF_FW_BOOTING		0x7e
+
+/* upper bound for the MCU to take a zone command */
+#define OV5640_AF_CMD_TIMEOUT_MS	100
+
+/* AF zones are placed on an 80x60 grid over the output image */
+#define OV5640_AF_GRID_W		80
+#define OV5640_AF_GRID_H		60
+#define OV5640_AF_TOUCH_ZONE		8	/* touch zone size, grid units */
+
 /* maximum time for one frame at minimum fps (15fps) in normal mode */
 #define NORMAL_MODE_MAX_ONE_FRAME_DELAY_MS     67
 
+/*
+ * Pixel clock of the preview, capture and ZSL register sets, derived from
+ * their PLL settings (0x3034-0x3037, 0x3108) with a 24MHz MCLK.
+ */
+#define OV5640_PREVIEW_PCLK_KHZ		56000
+#define OV5640_CAPTURE_PCLK_KHZ		33600
+#define OV5640_ZSL_PCLK_KHZ		44800
+
+/*
+ * All register tables are tuned for a 24MHz MCLK with PLL pre-divider 3.
+ * With another MCLK the pre-divider 0x3037[3:0] and multiplier 0x3036
+ * are retuned on their way to the sensor so the VCO stays as close to
+ * the tuned one as the dividers allow.
+ */
+#define OV5640_REG_PLL_MULT		0x3036
+#define OV5640_REG_PLL_PREDIV		0x3037
+#define OV5640_PLL_REF_KHZ		24000
+#define OV5640_PLL_REF_PREDIV		3
+#define OV5640_MCLK_MIN_KHZ		6000
+#define OV5640_MCLK_MAX_KHZ		27000
+
+/* MIPI CSI-2 interface, two data lanes on virtual channel 0 */
+#define OV5640_MIPI_LANES		2
+#define OV5640_REG_IO_MIPI_CTRL00	0x300e
+#define OV5640_REG_FRAME_CTRL01		0x4202
+#define OV5640_REG_MIPI_CTRL00		0x4800
+#define OV5640_REG_PCLK_PERIOD		0x4837
+
+/* AEC dummy lines added to VTS by night mode */
+#define OV5640_REG_AEC_VTS_EXTRA	0x350c
+
+/* group hold, 0x3212: latch register writes in a group, apply them at once */
+#define OV5640_REG_GROUP_ACCESS		0x3212
+#define OV5640_GROUP_HOLD_START(g)	(g)
+#define OV5640_GROUP_HOLD_END(g)	(0x10 | (g))
+#define OV5640_GROUP_LAUNCH(g)		(0xa0 | (g))	/* quick launch */
+
+/*
+ * 0x3200-0x3203 hold the start of groups 0-3 in the group buffer, in
+ * 16-byte units; a held write takes 4 bytes there (16-bit address, value
+ * and a pad byte). A capture delta larger than group 0 is not pre-staged
+ * but written at capture time.
+ */
+#define OV5640_REG_GROUP_ADDR		0x3200
+#define OV5640_GROUP_ADDR_UNIT		16
+#define OV5640_GROUP_ENTRY_BYTES	4
+
+/* exposure, gain and VTS carried by each bracketing group */
+#define OV5640_BRACKET_REGS		7
+
+/*
+ * A group launched after frame n ends is latched at the next frame start,
+ * which is already under way, so frame n + 2 is the first one exposed
+ * with it
+ */
+#define OV5640_BRACKET_DELAY		2
+
 
 
 #define S5K4BA_DRIVER_NAME	"OV5640"
+
+/*
+ * Debug categories. Hot-path messages are dev_dbg() based, so they need
+ * dynamic debug enabled for the module and the matching bit set in the
+ * "debug" parameter; they are also rate limited. With the bits clear a
+ * call site costs one test of a global.
+ */
+#define OV5640_DBG_I2C		(1 << 0)
+#define OV5640_DBG_AF		(1 << 1)
+#define OV5640_DBG_MODE		(1 << 2)
+#define OV5640_DBG_CTRL		(1 << 3)
+
+static unsigned int debug;
+module_param(debug, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(debug, "debug categories: 1=i2c 2=af 4=mode 8=ctrl");
+
+#define ov5640_dbg_on(cat)	unlikely(debug & (cat))
+
+#define ov5640_dbg(sd, cat, fmt, arg...)				\
+do {									\
+	static DEFINE_RATELIMIT_STATE(_rs, DEFAULT_RATELIMIT_INTERVAL,	\
+				DEFAULT_RATELIMIT_BURST);		\
+	struct i2c_client *_c = v4l2_get_subdevdata(sd);		\
+									\
+	if (ov5640_dbg_on(cat) && __ratelimit(&_rs))			\
+		dev_dbg(&_c->dev, fmt, ##arg);				\
+} while (0)
 #define SAMPLE_CODE 0
 /* Default resolution & pixelformat. plz ref s5k4ba_platform.h */
 #define DEFAULT_RES		WVGA	/* Index of resoultion */
@@ -62,7 +189,7 @@ enum s5k4ba_oprmode {
 /*
  * Specification
  * Parallel : ITU-R. 656/601 YUV422, RGB565, RGB888 (Up to VGA), RAW10
- * Serial : MIPI CSI2 (single lane) YUV422, RGB565, RGB888 (Up to VGA), RAW10
+ * Serial : MIPI CSI2 (up to two lanes) YUV422, RGB565, RGB888, RAW10
  * Resolution : 1280 (H) x 1024 (V)
  * Image control : Brightness, Contrast, Saturation, Sharpness, Glamour
  * Effect : Mono, Negative, Sepia, Aqua, Sketch
@@ -84,6 +211,8 @@ struct s5k4ba_userset {
 	unsigned int saturation;	/* V4L2_CID_SATURATION */
 	unsigned int sharpness;		/* V4L2_CID_SHARPNESS */
 	unsigned int glamour;
+	unsigned int banding;	/* enum ov5640_banding */
+	unsigned int night_fps;	/* V4L2_CID_OV5640_NIGHT_MIN_FPS */
 };
 
 struct s5k4ba_version {
@@ -137,6 +266,122 @@ struct s5k4ba_gps_info {
         unsigned char altitude_buf[4];
         int gps_timeStamp;
 };
+
+/*
+ * Last AF MCU status seen by the driver. The AF engine refreshes it
+ * whenever it reads the status registers itself, and HAL polls are
+ * served from here until it is older than one frame period.
+ */
+struct ov5640_af_cache {
+	u8 cmd_ack;		/* 0x3023: 0 once the MCU took the command */
+	u8 focus_status;	/* 0x3028: non-zero once focused */
+	unsigned long stamp;	/* jiffies of the last refresh */
+	bool valid;
+	bool settled;		/* end of the search handled, see g_ctrl */
+};
+
+/* lens positions found by AF, keyed by the scene distance set by the host */
+#define OV5640_FOCUS_CACHE_SIZE	8
+
+struct ov5640_focus_entry {
+	u32 distance_mm;	/* 0 for an unused entry */
+	u16 dac;		/* VCM DAC code */
+	unsigned long stamp;	/* jiffies of the last use */
+};
+
+/*
+ * Control values g_ctrl answers without the sensor. s_ctrl publishes them
+ * under ctrl_seq, so reading them never waits for ctrl_lock.
+ */
+struct ov5640_ctrl_snap {
+	int white_balance;
+	int effects;
+	int contrast;
+	int saturation;
+	int sharpness;
+	int exposure_bias;
+	int zsl;
+	u32 focus_distance_mm;
+	int flash;
+	int ae_lock;
+	int awb_lock;
+	int wb_temp;
+	int banding;
+	int night_fps;
+};
+
+/* anti-banding, numbered like V4L2_CID_POWER_LINE_FREQUENCY */
+enum ov5640_banding {
+	OV5640_BANDING_OFF,
+	OV5640_BANDING_50HZ,
+	OV5640_BANDING_60HZ,
+	OV5640_BANDING_AUTO,
+};
+
+/* V4L2_POWER_LINE_FREQUENCY_AUTO came with 3.2 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 2, 0)
+#define OV5640_POWER_LINE_MAX	OV5640_BANDING_AUTO
+#else
+#define OV5640_POWER_LINE_MAX	OV5640_BANDING_60HZ
+#endif
+
+/* V4L2_CID_CAMERA_ANTI_BANDING values by enum ov5640_banding */
+static const int ov5640_anti_banding[] = {
+	[OV5640_BANDING_OFF] = ANTI_BANDING_OFF,
+	[OV5640_BANDING_50HZ] = ANTI_BANDING_50HZ,
+	[OV5640_BANDING_60HZ] = ANTI_BANDING_60HZ,
+	[OV5640_BANDING_AUTO] = ANTI_BANDING_AUTO,
+};
+
+/* latency histograms kept in struct ov5640_stats */
+enum ov5640_latency {
+	OV5640_LAT_INIT,	/* ov5640_init(sd, 0) */
+	OV5640_LAT_PREVIEW,	/* s_stream(1) config flush, e.g. preview */
+	OV5640_LAT_CAPTURE,	/* ov5640_start_capture */
+	OV5640_LAT_AF,		/* single AF trigger to lock */
+	OV5640_LAT_CTRL_LOCK,	/* ctrl_lock hold time in s_ctrl */
+	OV5640_LAT_NUM,
+};
+
+/* bucket n counts samples in [2^(n-1), 2^n) us, the last one is open */
+#define OV5640_HIST_BUCKETS	24
+
+/* per-sensor I2C counters and latency histograms, shown in debugfs */
+struct ov5640_stats {
+	atomic_t transfers;
+	atomic_long_t bytes;
+	atomic_t retries;
+	atomic_t errors;
+	atomic_t elided;	/* register writes skipped as redundant */
+	atomic_t hist[OV5640_LAT_NUM][OV5640_HIST_BUCKETS];
+};
+
+/*
+ * Host copy of the sensor registers 0x3000-0x5fff as last written by the
+ * driver. Mode changes are worked out against it so that only registers
+ * whose value actually changes go to the sensor.
+ */
+#define OV5640_SHADOW_BASE	0x3000
+#define OV5640_SHADOW_SIZE	0x3000
+
+struct ov5640_shadow {
+	u8 val[OV5640_SHADOW_SIZE];
+	DECLARE_BITMAP(valid, OV5640_SHADOW_SIZE);
+};
+
+struct ov5640_capture_stage;
+struct ov5640_mode;
+
+/*
+ * Sensor configuration. Format, frame rate and the capture/preview paths
+ * only update state->pending; ov5640_flush_config() turns it into one
+ * register plan at s_stream(1) or at the capture trigger.
+ */
+struct ov5640_config {
+	const struct ov5640_mode *mode;
+	u32 fps;		/* requested frame rate, 0 for the mode's own */
+};
+
 struct s5k4ba_state {
 	struct s5k4ba_platform_data *pdata;
 	struct v4l2_subdev sd;
@@ -153,8 +398,13 @@ struct s5k4ba_state {
 	struct s5k4ba_userset userset; 
 	enum af_operation_status af_status; 
 	enum s5k4ba_oprmode oprmode; 
-	struct mutex ctrl_lock;
+	enum s5k4ba_runmode runmode;
+	struct mutex ctrl_lock;	/* sensor state changes, held by s_ctrl */
+	struct mutex bus_lock;	/* one transfer including its retries */
+	seqlock_t ctrl_seq;
+	struct ov5640_ctrl_snap snap;	/* under ctrl_seq */
 	int freq;	/* MCLK in KHz */
+	u8 pll_prediv;	/* 0x3037[3:0] for this MCLK */
 	int is_mipi;
 	int isize;
 	int ver;
@@ -167,12 +417,83 @@ struct s5k4ba_state {
         int check_previewdata;
         bool flash_on;
         bool torch_on;
-        bool sensor_af_in_low_light_mode;
         int flash_state_on_previous_capture;
         bool initialized;
         bool restore_preview_size_needed;
         int one_frame_delay_ms;
+	int pclk_khz;	/* pixel clock of the running register set */
+	struct ov5640_config pending;	/* requested, see ov5640_config */
+	struct ov5640_config active;	/* on the sensor, mode NULL if unknown */
+	struct v4l2_mbus_framefmt fmt;	/* active pad format */
+	struct media_pad pad;
 
+	/*
+	 * af_cache, af_status and af_cached are written with ctrl_lock and
+	 * af_lock held, so AF polls can read them under af_lock alone
+	 */
+	spinlock_t af_lock;
+	struct ov5640_af_cache af_cache;
+	ktime_t af_start;	/* single AF trigger time, 0 when idle */
+	bool af_continuous;	/* MCU runs continuous AF (command 0x04) */
+	u8 revision;		/* 0x302a, read at probe or first power-up */
+	bool chip_checked;
+	bool af_cached;		/* lens set from focus_cache, no search ran */
+	u32 focus_distance_mm;	/* V4L2_CID_OV5640_FOCUS_DISTANCE, 0 unknown */
+	struct ov5640_focus_entry focus_cache[OV5640_FOCUS_CACHE_SIZE];
+
+	struct ov5640_stats stats;
+	struct dentry *debugfs_dir;
+
+	/* background init pipeline, see ov5640_init_work() */
+	struct workqueue_struct *wq;
+	struct work_struct init_work;
+	struct completion base_done;	/* base config pushed */
+	struct completion af_ready;	/* AF firmware uploaded */
+	int base_err;
+	int af_err;
+
+	/*
+	 * records of the tuning container replayed on each power-up, copied
+	 * out on the first one so the container itself can be released
+	 */
+	u8 *tuning_recs;
+	size_t tuning_len;
+	bool tuning_done;
+
+	/* register shadow and capture pre-staging, see ov5640_arm_capture() */
+	struct ov5640_shadow *shadow;
+	struct ov5640_capture_stage *capture;
+	bool shadow_hold;	/* writes go to a group hold, not applied yet */
+	bool capture_armed;
+
+	/* ZSL streaming and its metadata ring, see ov5640_zsl_work() */
+	bool zsl;
+	struct work_struct zsl_work;
+	spinlock_t zsl_lock;
+	u32 zsl_count;		/* samples taken, the ring head */
+	struct ov5640_frame_meta zsl_meta[OV5640_ZSL_META_DEPTH];
+
+	/* 0x3212 group holds, staging and launches */
+	struct mutex group_lock;
+
+	/*
+	 * frame end notifications from the host, see ov5640_frame_end();
+	 * under bracket_lock
+	 */
+	bool frame_events;
+	u32 frame_seq;
+
+	/* exposure bracketing from group holds, see ov5640_bracket_work() */
+	bool bracket;		/* a sequence is running */
+	struct work_struct bracket_work;
+	spinlock_t bracket_lock;	/* also taken from the frame end irq */
+	u32 bracket_shots;
+	u32 bracket_next;	/* next group to launch */
+	u32 bracket_hts;
+	u8 bracket_vals[OV5640_BRACKET_MAX][OV5640_BRACKET_REGS];
+	u8 bracket_saved[OV5640_BRACKET_REGS];
+	u8 bracket_aec;		/* 0x3503 before the sequence */
+	struct ov5640_bracket_frame bracket_meta[OV5640_BRACKET_MAX];
 } ;
 
 
@@ -182,6 +503,33 @@ static inline struct s5k4ba_state *to_state(struct v4l2_subdev *sd)
 {
 	return container_of(sd, struct s5k4ba_state, sd);
 }
+
+static void ov5640_stats_latency(struct s5k4ba_state *state,
+				enum ov5640_latency which, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int bucket = us > 0 ? fls64(us) : 0;
+
+	if (bucket >= OV5640_HIST_BUCKETS)
+		bucket = OV5640_HIST_BUCKETS - 1;
+	atomic_inc(&state->stats.hist[which][bucket]);
+}
+
+static void ov5640_set_runmode(struct s5k4ba_state *state,
+				enum s5k4ba_runmode runmode)
+{
+	trace_ov5640_runmode(state->runmode, runmode);
+	state->runmode = runmode;
+}
+
+static void ov5640_set_af_status(struct s5k4ba_state *state,
+				enum af_operation_status af_status)
+{
+	trace_ov5640_af_status(state->af_status, af_status);
+	spin_lock(&state->af_lock);
+	state->af_status = af_status;
+	spin_unlock(&state->af_lock);
+}
 /**
  * struct ov5640_reg - ov5640 register format
  * @reg: 16-bit offset to register
@@ -195,6 +543,49 @@ struct ov5640_reg {
         u8      val;
 };
 
+/*
+ * Register sequences run by ov5640_run_seq(). Writes to consecutive
+ * registers are merged into one burst; a poll succeeds once
+ * (reg & mask) == val (!= for POLL_NE) and fails after arg ms.
+ */
+enum ov5640_seq_op {
+	OV5640_SEQ_OP_WRITE,
+	OV5640_SEQ_OP_BURST,	/* arg bytes from data */
+	OV5640_SEQ_OP_MASK,	/* reg = (reg & ~mask) | val */
+	OV5640_SEQ_OP_DELAY,	/* arg us */
+	OV5640_SEQ_OP_POLL,
+	OV5640_SEQ_OP_POLL_NE,
+};
+
+struct ov5640_seq {
+	u8 op;
+	u8 val;
+	u8 mask;
+	u16 reg;
+	u32 arg;
+	const u8 *data;
+};
+
+#define OV5640_SEQ_W(r, v) \
+	{ .op = OV5640_SEQ_OP_WRITE, .reg = (r), .val = (v) }
+#define OV5640_SEQ_BURST(r, d) \
+	{ .op = OV5640_SEQ_OP_BURST, .reg = (r), .data = (d), \
+	  .arg = sizeof(d) }
+#define OV5640_SEQ_MASK(r, m, v) \
+	{ .op = OV5640_SEQ_OP_MASK, .reg = (r), .mask = (m), .val = (v) }
+#define OV5640_SEQ_US(us) \
+	{ .op = OV5640_SEQ_OP_DELAY, .arg = (us) }
+#define OV5640_SEQ_POLL(r, m, v, ms) \
+	{ .op = OV5640_SEQ_OP_POLL, .reg = (r), .mask = (m), .val = (v), \
+	  .arg = (ms) }
+#define OV5640_SEQ_POLL_NE(r, m, v, ms) \
+	{ .op = OV5640_SEQ_OP_POLL_NE, .reg = (r), .mask = (m), .val = (v), \
+	  .arg = (ms) }
+
+/* polls start fast and back off up to this interval */
+#define OV5640_SEQ_POLL_MIN_US		100
+#define OV5640_SEQ_POLL_MAX_US		8000
+
 static const struct ov5640_reg OV5640_CAMERA_Module_AF_POST[] ={
                              // Auto focus settings     
                          {0x3022, 0x00},
@@ -209,6 +600,17 @@ static const struct ov5640_reg OV5640_CAMERA_Module_AF_POST[] ={
 
 };
 
+/*
+ * AF_POST leaves 0xff in 0x3029; the MCU replaces it once it runs and
+ * holds 0x7e/0x7f while it initialises.
+ */
+static const struct ov5640_seq ov5640_af_boot_seq[] = {
+	OV5640_SEQ_POLL_NE(OV5640_REG_AF_FW_STATUS, 0xff, 0xff,
+			OV5640_AF_FW_TIMEOUT_MS),
+	OV5640_SEQ_POLL_NE(OV5640_REG_AF_FW_STATUS, 0xfe, OV5640_AF_FW_BOOTING,
+			OV5640_AF_FW_TIMEOUT_MS),
+};
+
 
 static const struct ov5640_reg OV5640_EV_M2[]=
 {
@@ -336,6 +738,71 @@ static const struct ov5640_reg regset_capture_resoxxxx[] = {
        
 };
 
+/*
+ * Full resolution streaming for ZSL: the 5M timing of
+ * regset_capture_resoxxxx with AEC/AGC and AWB left running and the PLL
+ * multiplier raised for ~8fps within the 48MHz pixel clock limit.
+ */
+static const struct ov5640_reg regset_zsl[] = {
+	{0x3035, 0x21},
+	{0x3036, 0x70},
+	{0x3C07, 0x07},
+	{0x3820, 0x40},
+	{0x3821, 0x06},
+	{0x3814, 0x11},
+	{0x3815, 0x11},
+	{0x3803, 0x00},
+	{0x3807, 0x9f},
+	{0x3808, 0x0a},
+	{0x3809, 0x20},
+	{0x380A, 0x07},
+	{0x380B, 0x98},
+	{0x380C, 0x0b},
+	{0x380D, 0x1C},
+	{0x380E, 0x07},
+	{0x380F, 0xb0},
+	{0x3813, 0x04},
+	{0x3618, 0x04},
+	{0x3612, 0x2B},
+	{0x3708, 0x21},
+	{0x3709, 0x12},
+	{0x370C, 0x00},
+	{0x3A02, 0x07},
+	{0x3A03, 0xB0},
+	{0x3A0E, 0x06},
+	{0x3A0D, 0x08},
+	{0x3A14, 0x07},
+	{0x3A15, 0xD0},
+	{0x4004, 0x06},
+	{0x4713, 0x02},
+	{0x4407, 0x0C},
+	{0x460B, 0x37},
+	{0x460C, 0x20},
+	{0x3824, 0x01},
+	{0x5001, 0x83},
+	{0x3008, 0x02},
+	{0x3002, 0x1c},
+	{0x3006, 0xc3},
+	{0x460b, 0x35},
+	{0x4003, 0x82},
+	{0x4003, 0x08},
+	{0x3503, 0x00},		// AEC/AGC on
+	{0x3406, 0x00},		// AWB on
+};
+
+/*
+ * Capture register set prepared by ov5640_arm_capture(): the entries of
+ * regset_capture_resoxxxx that change the sensor state, split into system
+ * control registers (0x30xx, PLL and clocks), which are written right
+ * before the launch, and the rest, latched in group hold 0.
+ */
+struct ov5640_capture_stage {
+	struct ov5640_reg direct[ARRAY_SIZE(regset_capture_resoxxxx)];
+	struct ov5640_reg group[ARRAY_SIZE(regset_capture_resoxxxx)];
+	int num_direct;
+	int num_group;
+};
+
 static const struct ov5640_reg configscript_common1[] = {
         		{ 0x3103, 0x11},
                          { 0x3008, 0x82},
@@ -942,287 +1409,1007 @@ static const struct ov5640_reg regset_auto_focus[] = {
 
 };
 
-static int ov5640_reg_read(struct v4l2_subdev *sd, u16 reg, u8 *val)
-{
-        struct i2c_client *client = v4l2_get_subdevdata(sd);
-        int ret;
-        u8 data[2] = {0};
-        struct i2c_msg msg = {
-                .addr   = client->addr,
-                .flags  = 0,
-                .len    = 2,
-                .buf    = data,
-        };
+/*
+ * MIPI video modes. Both run the sensor at an 84MHz pixel clock
+ * (MCLK 24MHz, PLL 0x3035/0x3036/0x3037 = 0x11/0x54/0x13), which is
+ * 672Mbps per lane for YUV422 on two lanes. The parallel port outputs
+ * are switched off.
+ */
+static const struct ov5640_reg regset_1080p30_mipi[] = {
+	{0x3017, 0x00},		// DVP outputs off
+	{0x3018, 0x00},
+	{0x3034, 0x18},		// MIPI 8 bit
+	{0x3035, 0x11},
+	{0x3036, 0x54},
+	{0x3037, 0x13},
+	{0x3108, 0x01},
+	{0x3C07, 0x07},
+	{0x3820, 0x40},
+	{0x3821, 0x06},
+	{0x3814, 0x11},
+	{0x3815, 0x11},
+	{0x3800, 0x01},		// 1920x1080 window, no binning
+	{0x3801, 0x50},
+	{0x3802, 0x01},
+	{0x3803, 0xB2},
+	{0x3804, 0x08},
+	{0x3805, 0xEF},
+	{0x3806, 0x05},
+	{0x3807, 0xF1},
+	{0x3808, 0x07},
+	{0x3809, 0x80},
+	{0x380A, 0x04},
+	{0x380B, 0x38},
+	{0x380C, 0x09},		// HTS 2500
+	{0x380D, 0xC4},
+	{0x380E, 0x04},		// VTS 1120
+	{0x380F, 0x60},
+	{0x3810, 0x00},
+	{0x3811, 0x10},
+	{0x3812, 0x00},
+	{0x3813, 0x04},
+	{0x3618, 0x04},
+	{0x3612, 0x2B},
+	{0x3708, 0x64},
+	{0x3709, 0x12},
+	{0x370C, 0x00},
+	{0x3A02, 0x04},
+	{0x3A03, 0x60},
+	{0x3A08, 0x01},
+	{0x3A09, 0x50},
+	{0x3A0A, 0x01},
+	{0x3A0B, 0x18},
+	{0x3A0E, 0x03},
+	{0x3A0D, 0x04},
+	{0x3A14, 0x04},
+	{0x3A15, 0x60},
+	{0x4001, 0x02},
+	{0x4004, 0x06},
+	{0x4005, 0x1A},
+	{0x4713, 0x02},
+	{0x4407, 0x04},
+	{0x460B, 0x37},
+	{0x460C, 0x20},
+	{0x3824, 0x04},
+	{0x5001, 0x83},
+	{0x3503, 0x00},
+};
+
+static const struct ov5640_reg regset_720p60_mipi[] = {
+	{0x3017, 0x00},		// DVP outputs off
+	{0x3018, 0x00},
+	{0x3034, 0x18},		// MIPI 8 bit
+	{0x3035, 0x11},
+	{0x3036, 0x54},
+	{0x3037, 0x13},
+	{0x3108, 0x01},
+	{0x3C07, 0x07},
+	{0x3820, 0x41},
+	{0x3821, 0x07},
+	{0x3814, 0x31},		// 2x2 binning
+	{0x3815, 0x31},
+	{0x3800, 0x00},
+	{0x3801, 0x00},
+	{0x3802, 0x00},
+	{0x3803, 0xFA},
+	{0x3804, 0x0A},
+	{0x3805, 0x3F},
+	{0x3806, 0x06},
+	{0x3807, 0xA9},
+	{0x3808, 0x05},
+	{0x3809, 0x00},
+	{0x380A, 0x02},
+	{0x380B, 0xD0},
+	{0x380C, 0x07},		// HTS 1892
+	{0x380D, 0x64},
+	{0x380E, 0x02},		// VTS 740
+	{0x380F, 0xE4},
+	{0x3810, 0x00},
+	{0x3811, 0x10},
+	{0x3812, 0x00},
+	{0x3813, 0x04},
+	{0x3618, 0x00},
+	{0x3612, 0x29},
+	{0x3708, 0x64},
+	{0x3709, 0x52},
+	{0x370C, 0x03},
+	{0x3A02, 0x02},
+	{0x3A03, 0xE4},
+	{0x3A08, 0x01},
+	{0x3A09, 0xBC},
+	{0x3A0A, 0x01},
+	{0x3A0B, 0x72},
+	{0x3A0E, 0x01},
+	{0x3A0D, 0x02},
+	{0x3A14, 0x02},
+	{0x3A15, 0xE4},
+	{0x4001, 0x02},
+	{0x4004, 0x02},
+	{0x4713, 0x02},
+	{0x4407, 0x04},
+	{0x460B, 0x37},
+	{0x460C, 0x20},
+	{0x3824, 0x04},
+	{0x5001, 0x83},
+	{0x3503, 0x00},
+};
 
-        data[0] = (u8)(reg >> 8);
-        data[1] = (u8)(reg & 0xff);
+/* streamable output sizes of one interface, in ascending order */
+struct ov5640_mode {
+	u32 width;
+	u32 height;
+	u32 fps;
+	int pclk_khz;
+	enum s5k4ba_runmode runmode;
+	const struct ov5640_reg *regs;
+	int num_regs;
+};
 
-        ret = i2c_transfer(client->adapter, &msg, 1);
-        if (ret < 0)
-                goto err;
+static const struct ov5640_mode ov5640_dvp_modes[] = {
+	{ 640, 480, 30, OV5640_PREVIEW_PCLK_KHZ, S5K4BA_RUNMODE_RUNNING,
+		regset_vga_preview, ARRAY_SIZE(regset_vga_preview) },
+};
 
-        msg.flags = I2C_M_RD;
-        msg.len = 1;
-        ret = i2c_transfer(client->adapter, &msg, 1);
-        if (ret < 0)
-                goto err;
+/*
+ * Still capture only: the table turns AEC/AGC and AWB off for the
+ * exposure computed at capture time, so it is not offered for streaming
+ */
+static const struct ov5640_mode ov5640_capture_mode = {
+	2592, 1936, 6, OV5640_CAPTURE_PCLK_KHZ, S5K4BA_RUNMODE_CAPTURE,
+	regset_capture_resoxxxx, ARRAY_SIZE(regset_capture_resoxxxx)
+};
 
-        *val = data[0];
-        return 0;
+static const struct ov5640_mode ov5640_mipi_modes[] = {
+	{ 1280, 720, 60, 84000, S5K4BA_RUNMODE_RUNNING,
+		regset_720p60_mipi, ARRAY_SIZE(regset_720p60_mipi) },
+	{ 1920, 1080, 30, 84000, S5K4BA_RUNMODE_RUNNING,
+		regset_1080p30_mipi, ARRAY_SIZE(regset_1080p30_mipi) },
+};
 
-err:
-        dev_err(&client->dev, "Failed reading register 0x%02x!\n", reg);
-        return ret;
-}
+#define OV5640_MODE_PREVIEW	(&ov5640_dvp_modes[0])
+#define OV5640_MODE_CAPTURE	(&ov5640_capture_mode)
 
-/**
- * s5k4ecgx_i2c_read_twobyte: Read 2 bytes from sensor
+/* YUYV, see 0x4300 in configscript_common1 */
+#define OV5640_MBUS_CODE	V4L2_MBUS_FMT_YUYV8_2X8
+
+/* largest auto-incrementing write, also the firmware upload chunk size */
+#define OV5640_BURST_MAX	256
+
+/* first retry backoff, doubled on every further attempt */
+#define OV5640_I2C_BACKOFF_US	100
+
+static unsigned int i2c_retries = 3;
+module_param(i2c_retries, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(i2c_retries, "retries of a failed I2C transfer (default 3)");
+
+/*
+ * Last resort before the final retry: let the adapter clock a stuck
+ * slave free where the I2C core supports bus recovery.
  */
-static int s5k4ecgx_i2c_read_twobyte(struct v4l2_subdev *sd,
-                                  u16 subaddr, u16 *data)
+static void ov5640_i2c_recover(struct v4l2_subdev *sd)
 {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 10, 0)
 	struct i2c_client *client = v4l2_get_subdevdata(sd);
-        int err;
-        unsigned char buf[2];
-        struct i2c_msg msg[2];
-
-        cpu_to_be16s(&subaddr);
 
-        msg[0].addr = client->addr;
-        msg[0].flags = 0;
-        msg[0].len = 2;
-        msg[0].buf = (u8 *)&subaddr;
+	if (i2c_recover_bus(client->adapter) == 0)
+		ov5640_dbg(sd, OV5640_DBG_I2C, "%s: bus recovered\n", __func__);
+#endif
+}
 
-        msg[1].addr = client->addr;
-        msg[1].flags = I2C_M_RD;
-        msg[1].len = 2;
-        msg[1].buf = buf;
+/*
+ * All bus traffic of the driver goes through here, so the per-sensor
+ * statistics account for every transfer. A failed transfer is resent up
+ * to i2c_retries times with exponential backoff; all messages the driver
+ * sends are safe to repeat.
+ * Returns @num on success like i2c_transfer(), or a negative error code.
+ */
+static int ov5640_i2c_transfer(struct v4l2_subdev *sd, struct i2c_msg *msgs,
+				int num)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct s5k4ba_state *state = to_state(sd);
+	struct ov5640_stats *stats = &state->stats;
+	unsigned int attempt, backoff = OV5640_I2C_BACKOFF_US;
+	int i, ret;
+
+	mutex_lock(&state->bus_lock);
+	for (attempt = 0; ; attempt++) {
+		ret = i2c_transfer(client->adapter, msgs, num);
+		atomic_inc(&stats->transfers);
+		if (ret == num)
+			break;
+
+		atomic_inc(&stats->errors);
+		ov5640_dbg(sd, OV5640_DBG_I2C,
+			"%s: 0x%04x attempt %u: %d of %d messages, ret %d\n",
+			__func__, msgs[0].len >= 2 ?
+				(msgs[0].buf[0] << 8) | msgs[0].buf[1] : 0,
+			attempt, ret < 0 ? 0 : ret, num, ret);
+		if (attempt >= i2c_retries) {
+			mutex_unlock(&state->bus_lock);
+			return ret < 0 ? ret : -EIO;
+		}
 
-        err = i2c_transfer(client->adapter, msg, 2);
-        if (unlikely(err != 2)) {
-                dev_err(&client->dev,
-                        "%s: register read fail\n", __func__);
-                return -EIO;
-        }
+		if (attempt + 1 == i2c_retries)
+			ov5640_i2c_recover(sd);
 
-        *data = ((buf[0] << 8) | buf[1]);
+		atomic_inc(&stats->retries);
+		usleep_range(backoff, 2 * backoff);
+		backoff *= 2;
+	}
+	mutex_unlock(&state->bus_lock);
 
-        return 0;
-} 
+	for (i = 0; i < num; i++)
+		atomic_long_add(msgs[i].len, &stats->bytes);
 
+	return ret;
+}
 
+/* scattered registers fetched per i2c_transfer() by ov5640_reg_read_batch */
+#define OV5640_READ_BATCH_MAX	8
 
 /**
- * Write a value to a register in ov5640 sensor device.
- * @client: i2c driver client structure.
- * @reg: Address of the register to read value from.
- * @val: Value to be written to a specific register.
+ * Read consecutive registers from the ov5640 sensor device.
+ * The address phase and the data phase go out as one repeated-start
+ * transfer, so a read costs a single bus transaction.
+ * @sd: subdev of the sensor.
+ * @reg: Address of the first register to read.
+ * @buf: Buffer receiving @len register values.
+ * @len: Number of registers to read.
  * Returns zero if successful, or non-zero otherwise.
  */
-static int ov5640_reg_write(struct v4l2_subdev *sd, u16 reg, u8 val)
+static int ov5640_reg_read_multi(struct v4l2_subdev *sd, u16 reg,
+				u8 *buf, u16 len)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(sd);
-        int ret;
-        unsigned char data[3] = { (u8)(reg >> 8), (u8)(reg & 0xff), val };
-        struct i2c_msg msg = {
-                .addr   = client->addr,
-                .flags  = 0,
-                .len    = 3,
-                .buf    = data,
-        };
+	u8 addr[2] = { (u8)(reg >> 8), (u8)(reg & 0xff) };
+	struct i2c_msg msg[2] = {
+		{
+			.addr	= client->addr,
+			.flags	= 0,
+			.len	= 2,
+			.buf	= addr,
+		}, {
+			.addr	= client->addr,
+			.flags	= I2C_M_RD,
+			.len	= len,
+			.buf	= buf,
+		},
+	};
+	int ret;
+
+	ret = ov5640_i2c_transfer(sd, msg, 2);
+	if (ret != 2) {
+		dev_err(&client->dev, "Failed reading register 0x%04x!\n", reg);
+		return ret < 0 ? ret : -EIO;
+	}
 
-        ret = i2c_transfer(client->adapter, &msg, 1);
-        if (ret < 0) {
-                dev_err(&client->dev, "Failed writing register 0x%02x!\n", reg);
-                return ret;
-        }
+	trace_ov5640_reg_read(reg, buf, len);
+	return 0;
+}
 
-        return 0;
+static int ov5640_reg_read(struct v4l2_subdev *sd, u16 reg, u8 *val)
+{
+	return ov5640_reg_read_multi(sd, reg, val, 1);
+}
+
+/* 16-bit register pair, MSB at @reg (e.g. gain 0x350A/0x350B) */
+static int ov5640_reg_read16(struct v4l2_subdev *sd, u16 reg, u16 *val)
+{
+	u8 buf[2];
+	int ret;
+
+	ret = ov5640_reg_read_multi(sd, reg, buf, 2);
+	if (ret)
+		return ret;
+
+	*val = (buf[0] << 8) | buf[1];
+	return 0;
+}
+
+/* 24-bit register triple, MSB at @reg (e.g. exposure 0x3500..0x3502) */
+static int ov5640_reg_read24(struct v4l2_subdev *sd, u16 reg, u32 *val)
+{
+	u8 buf[3];
+	int ret;
+
+	ret = ov5640_reg_read_multi(sd, reg, buf, 3);
+	if (ret)
+		return ret;
+
+	*val = (buf[0] << 16) | (buf[1] << 8) | buf[2];
+	return 0;
 }
+
 /**
- * Initialize a list of ov5640 registers.
- * The list of registers is terminated by the pair of values
- * @client: i2c driver client structure.
- * @reglist[]: List of address of the registers to write data.
+ * Read a set of scattered registers.
+ * Every register gets its own write/read message pair, chained with
+ * repeated starts, so up to OV5640_READ_BATCH_MAX registers cost one
+ * i2c_transfer() and one adapter lock round trip.
+ * @sd: subdev of the sensor.
+ * @regs: Addresses of the registers to read.
+ * @vals: Receives the value of regs[i] in vals[i].
+ * @count: Number of registers.
  * Returns zero if successful, or non-zero otherwise.
  */
-static int ov5640_reg_writes(struct v4l2_subdev *sd,
-                             const struct ov5640_reg reglist[],
-                             int size)
+static int ov5640_reg_read_batch(struct v4l2_subdev *sd, const u16 *regs,
+				u8 *vals, int count)
 {
-        int err = 0, i;
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct i2c_msg msg[2 * OV5640_READ_BATCH_MAX];
+	u8 addr[OV5640_READ_BATCH_MAX][2];
+	int i, n, ret;
+
+	while (count > 0) {
+		n = min(count, OV5640_READ_BATCH_MAX);
+
+		for (i = 0; i < n; i++) {
+			addr[i][0] = (u8)(regs[i] >> 8);
+			addr[i][1] = (u8)(regs[i] & 0xff);
+
+			msg[2 * i].addr = client->addr;
+			msg[2 * i].flags = 0;
+			msg[2 * i].len = 2;
+			msg[2 * i].buf = addr[i];
+
+			msg[2 * i + 1].addr = client->addr;
+			msg[2 * i + 1].flags = I2C_M_RD;
+			msg[2 * i + 1].len = 1;
+			msg[2 * i + 1].buf = &vals[i];
+		}
 
-        for (i = 0; i < size; i++) {
-                err = ov5640_reg_write(sd, reglist[i].reg,
-                                reglist[i].val);
-                if (err)
-                        return err; 
-		//u8 value = 0;
-        	//ov5640_reg_read(sd, reglist[i].reg, &value);
-		mdelay(1);
-		//printk(" register (%x ,  %x)\n",reglist[i].reg, value );
-        }
-        return 0;
-}
-static int ov540_block_writes(struct v4l2_subdev *sd, const struct ov5640_reg reglist[],int size){ 
-
-      struct i2c_client *client = v4l2_get_subdevdata(sd);
-      int err = 0, i; 
-      u16     startaddr;
-      u16       preaddr;
-      u16         addr;
-      u8      data[256];
-      
-      unsigned int length;
-      length    = 0;
-      startaddr = 0;
-      preaddr   = 0; 
-      
-      for (i = 0; i < size; i++) {
-	addr = reglist[i].reg; 
-
-          if(length == 0){
-                 startaddr      = addr;
-             data[length++] = reglist[i].val;// buf[i+2];
-             preaddr        = addr+1;
-          }
-          else{
-             if((addr != preaddr) || (length > 192)){
-		u8 buf[4+length];		
-        	unsigned int j =0;
-        	struct i2c_msg msg = {client->addr, 0, 2+length, buf};
-        	buf[0] = (u8)((startaddr>>8)& 0x00FF);
-        	buf[1] = (u8)((startaddr>>0)& 0x00FF);
-        	//printk(" [ Buf[0] = 0x%x and buf[1] = 0x%x",buf[0],buf[1]);
-        	for (j = 0; j < length; j++){
-                	buf[2+j] = data[j];
-        		//printk("\n buf[2+%d] = %x",j,buf[2+j]);
+		ret = ov5640_i2c_transfer(sd, msg, 2 * n);
+		if (ret != 2 * n) {
+			dev_err(&client->dev,
+				"Failed reading register batch at 0x%04x!\n",
+				regs[0]);
+			return ret < 0 ? ret : -EIO;
 		}
-		int ret;
-		ret = i2c_transfer(client->adapter, &msg, 1);
-                if (ret < 0) {
-                    dev_err(&client->dev, "Failed writing register 0x%02x!\n", startaddr);
-                    return ret;
-        	} 
-		mdelay(1);
-
-                startaddr = addr;
-                length    = 0;
-             }
-             data[length++] = reglist[i].val;
-             preaddr        = addr+1;
-          }
-   
-      } 
-      if(length){
-		u8 buf[length];
-                unsigned int k =0;
-                struct i2c_msg msg = {client->addr, 0, 2+length, buf};
-                buf[0] = (u8)((startaddr>>8)& 0x00FF);
-                buf[1] = (u8)((startaddr>>0)& 0x00FF);
-                //printk(" [ Buf[0] = 0x%x and buf[1] = 0x%x",buf[0],buf[1]);
-                for (k = 0; k < length; k++)
-                      buf[2+k] = data[k];
-                //printk("\n buf[2+%d] = %x",i,buf[2+i]);
-                     int ret;
-                     ret = i2c_transfer(client->adapter, &msg, 1);
-                     if (ret < 0) {
-                            dev_err(&client->dev, "Failed writing register 0x%02x!\n", startaddr);
-                        return ret;
-                     }
-		    mdelay(1);
-      }
-        return 0;
-}
 
-static int  ov5640_firmware_download_af(struct v4l2_subdev *sd){
+		for (i = 0; i < n; i++)
+			trace_ov5640_reg_read(regs[i], &vals[i], 1);
 
-        u8 *firmwarebuf = (unsigned char *)OV5640_CAMERA_Module_AF_Init_DATA;
-        unsigned int length = sizeof(OV5640_CAMERA_Module_AF_Init_DATA ); 
-	//printk(" Firmware buffer length = %d \n ",length);
+		regs += n;
+		vals += n;
+		count -= n;
+	}
 
-        struct i2c_client *client = v4l2_get_subdevdata(sd);
+	return 0;
+}
 
-        int err = 0; u8 value = 0;
-        err = ov5640_reg_write(sd, 0x3000,0x20);
-        if(err){
-                printk("\n Error in fimware start download start cmd.{0x3000,0x20 }");
-        }
-        mdelay(1);
-        ov5640_reg_read(sd, 0x3000, &value);
-        printk(" Frimware download start(%x ,  %x)\n",0x3000, value );
+/* registers the sensor updates on its own, never kept in the shadow */
+static bool ov5640_reg_volatile(u16 reg)
+{
+	return (reg >= 0x3022 && reg <= 0x3029) ||	/* AF MCU mailbox */
+		reg == OV5640_REG_GROUP_ACCESS ||
+		(reg >= 0x3400 && reg <= 0x3405) ||	/* AWB gains */
+		reg == 0x3602 || reg == 0x3603 ||	/* VCM DAC, AF MCU */
+		(reg >= 0x3500 && reg <= 0x350d);	/* AEC/AGC */
+}
 
-        u8 buf[2+length];
-	unsigned int i =0;
-        struct i2c_msg msg = {client->addr, 0, 2+length, buf};
-        u16 addr = 0x8000;
-        buf[0] = (u8)((addr>>8)& 0x00FF);
-        buf[1] = (u8)((addr>>0)& 0x00FF);
-
-        //printk(" [ Buf[0] = 0x%x and buf[1] = 0x%x",buf[0],buf[1]);
-        for (i = 0; i < length; i++) 
-                buf[2+i] = firmwarebuf[i]; 
-	//	printk("\n buf[2+%d] = %x",i,buf[2+i]);
-	
+static bool ov5640_capture_touches(u16 reg)
+{
+	int i;
 
-	
+	for (i = 0; i < ARRAY_SIZE(regset_capture_resoxxxx); i++)
+		if (regset_capture_resoxxxx[i].reg == reg)
+			return true;
+	return false;
+}
+
+static void ov5640_shadow_reset(struct s5k4ba_state *state)
+{
+	if (state->shadow)
+		bitmap_zero(state->shadow->valid, OV5640_SHADOW_SIZE);
+}
+
+/* record a register value that reached the sensor */
+static void ov5640_shadow_set(struct s5k4ba_state *state, u16 reg, u8 val)
+{
+	struct ov5640_shadow *shadow = state->shadow;
+	int i = (int)reg - OV5640_SHADOW_BASE;
+
+	if (!shadow || state->shadow_hold)
+		return;
+
+	/* software reset brings every register back to its default */
+	if (reg == 0x3008 && (val & 0x80)) {
+		ov5640_shadow_reset(state);
+		state->capture_armed = false;
+		return;
+	}
+
+	if (i < 0 || i >= OV5640_SHADOW_SIZE || ov5640_reg_volatile(reg))
+		return;
+
+	/* the staged capture delta assumed the old value */
+	if (state->capture_armed && (!test_bit(i, shadow->valid) ||
+			shadow->val[i] != val) && ov5640_capture_touches(reg))
+		state->capture_armed = false;
+
+	shadow->val[i] = val;
+	set_bit(i, shadow->valid);
+}
+
+static bool ov5640_shadow_get(struct s5k4ba_state *state, u16 reg, u8 *val)
+{
+	struct ov5640_shadow *shadow = state->shadow;
+	int i = (int)reg - OV5640_SHADOW_BASE;
+
+	if (!shadow || i < 0 || i >= OV5640_SHADOW_SIZE ||
+			!test_bit(i, shadow->valid))
+		return false;
+
+	*val = shadow->val[i];
+	return true;
+}
+
+/* pick the pre-divider that gets closest to the tuned PLL input */
+static int ov5640_set_mclk(struct s5k4ba_state *state, u32 khz)
+{
+	static const u8 prediv[] = { 1, 2, 3, 4, 6, 8 };
+	const int ref = OV5640_PLL_REF_KHZ / OV5640_PLL_REF_PREDIV;
+	int i, best = OV5640_PLL_REF_PREDIV;
+
+	if (khz < OV5640_MCLK_MIN_KHZ || khz > OV5640_MCLK_MAX_KHZ)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(prediv); i++)
+		if (abs((int)khz / prediv[i] - ref) < abs((int)khz / best - ref))
+			best = prediv[i];
+
+	state->freq = khz;
+	state->pll_prediv = best;
+	return 0;
+}
+
+/* multiplier giving the VCO of the tuned @mult at the current MCLK */
+static u8 ov5640_pll_mult(struct s5k4ba_state *state, u8 mult)
+{
+	u32 m;
+
+	m = DIV_ROUND_CLOSEST((u32)mult * OV5640_PLL_REF_KHZ * state->pll_prediv,
+			(u32)state->freq * OV5640_PLL_REF_PREDIV);
+	m = clamp_t(u32, m, 4, 252);
+	if (m > 127)
+		m &= ~1;	/* only even multipliers above 127 */
+	return m;
+}
+
+/* value to put on the wire for a table value of @reg */
+static u8 ov5640_pll_wire(struct s5k4ba_state *state, u16 reg, u8 val)
+{
+	if (state->freq == OV5640_PLL_REF_KHZ)
+		return val;
+
+	switch (reg) {
+	case OV5640_REG_PLL_MULT:
+		return ov5640_pll_mult(state, val);
+	case OV5640_REG_PLL_PREDIV:
+		return (val & 0xf0) | state->pll_prediv;
+	}
+	return val;
+}
+
+/* pixel clock of a set tuned for @ref_khz with multiplier @mult */
+static int ov5640_pll_pclk(struct s5k4ba_state *state, int ref_khz, u8 mult)
+{
+	if (state->freq == OV5640_PLL_REF_KHZ || !mult)
+		return ref_khz;
+
+	return div_u64((u64)ref_khz * state->freq * OV5640_PLL_REF_PREDIV *
+			ov5640_pll_mult(state, mult),
+			(u32)OV5640_PLL_REF_KHZ * state->pll_prediv * mult);
+}
+
+/* the same for the register set on the sensor */
+static int ov5640_pclk_khz(struct s5k4ba_state *state, int ref_khz)
+{
+	u8 mult;
+
+	if (!ov5640_shadow_get(state, OV5640_REG_PLL_MULT, &mult))
+		return ref_khz;
+	return ov5640_pll_pclk(state, ref_khz, mult);
+}
+
+/**
+ * Write a value to a register in ov5640 sensor device.
+ * @client: i2c driver client structure.
+ * @reg: Address of the register to read value from.
+ * @val: Value to be written to a specific register.
+ * Returns zero if successful, or non-zero otherwise.
+ */
+static int ov5640_reg_write(struct v4l2_subdev *sd, u16 reg, u8 val)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
         int ret;
+        unsigned char data[3] = { (u8)(reg >> 8), (u8)(reg & 0xff),
+                ov5640_pll_wire(to_state(sd), reg, val) };
+        struct i2c_msg msg = {
+                .addr   = client->addr,
+                .flags  = 0,
+                .len    = 3,
+                .buf    = data,
+        };
 
-        ret = i2c_transfer(client->adapter, &msg, 1);
+        ret = ov5640_i2c_transfer(sd, &msg, 1);
         if (ret < 0) {
-                dev_err(&client->dev, "Failed writing register 0x%02x!\n", addr);
+                dev_err(&client->dev, "Failed writing register 0x%02x!\n", reg);
                 return ret;
         }
 
-        //err = ov5640_reg_writes(sd, OV5640_CAMERA_Module_AF_POST,
-          //    ARRAY_SIZE(OV5640_CAMERA_Module_AF_POST));
-	err = ov540_block_writes(sd, OV5640_CAMERA_Module_AF_POST,ARRAY_SIZE(OV5640_CAMERA_Module_AF_POST));
-	if (err){
-                printk(" OV5640 AF setting failed ");
+        trace_ov5640_reg_write(reg, data[2]);
+        ov5640_shadow_set(to_state(sd), reg, val);
+        return 0;
+}
+
+/* explicit waits go through here so they show up in the trace */
+static void ov5640_mdelay(unsigned int ms)
+{
+	trace_ov5640_delay(ms * 1000);
+	mdelay(ms);
+}
+
+static void ov5640_msleep(unsigned int ms)
+{
+	trace_ov5640_delay(ms * 1000);
+	msleep(ms);
+}
+/**
+ * Initialize a list of ov5640 registers.
+ * The list of registers is terminated by the pair of values
+ * @client: i2c driver client structure.
+ * @reglist[]: List of address of the registers to write data.
+ * Returns zero if successful, or non-zero otherwise.
+ */
+static int ov5640_reg_writes(struct v4l2_subdev *sd,
+                             const struct ov5640_reg reglist[],
+                             int size)
+{
+        int err = 0, i;
+
+        trace_ov5640_table_start(reglist, size);
+        for (i = 0; i < size; i++) {
+                err = ov5640_reg_write(sd, reglist[i].reg,
+                                reglist[i].val);
+                if (err)
+                        break;
+		ov5640_mdelay(1);
         }
+        trace_ov5640_table_end(reglist, err);
+        return err;
+}
+/**
+ * Write a run of consecutive registers in one auto-incrementing message.
+ * The transport retries the message on its own, so a burst that fails
+ * is resent alone and a long table or firmware push resumes from the
+ * failed chunk instead of restarting.
+ * @sd: subdev of the sensor.
+ * @reg: Address of the first register.
+ * @data: Values for @len registers starting at @reg.
+ * @len: Number of registers, at most OV5640_BURST_MAX.
+ * Returns zero if successful, or non-zero otherwise.
+ */
+static int ov5640_burst_write(struct v4l2_subdev *sd, u16 reg,
+				const u8 *data, u16 len)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct s5k4ba_state *state = to_state(sd);
+	u8 buf[2 + OV5640_BURST_MAX];
+	struct i2c_msg msg = {
+		.addr	= client->addr,
+		.flags	= 0,
+		.len	= 2 + len,
+		.buf	= buf,
+	};
+	int i, ret;
+
+	if (WARN_ON(len > OV5640_BURST_MAX))
+		return -EINVAL;
+
+	buf[0] = (u8)(reg >> 8);
+	buf[1] = (u8)(reg & 0xff);
+	memcpy(&buf[2], data, len);
+	if (reg <= OV5640_REG_PLL_PREDIV && reg + len > OV5640_REG_PLL_MULT)
+		for (i = 0; i < len; i++)
+			buf[2 + i] = ov5640_pll_wire(state, reg + i, data[i]);
+
+	ret = ov5640_i2c_transfer(sd, &msg, 1);
+	trace_ov5640_burst(reg, len, ret < 0 ? ret : 0);
+	if (ret < 0) {
+		dev_err(&client->dev, "Failed writing register 0x%02x!\n", reg);
+		return ret;
+	}
+
+	if (reg < OV5640_SHADOW_BASE + OV5640_SHADOW_SIZE)
+		for (i = 0; i < len; i++)
+			ov5640_shadow_set(state, reg + i, data[i]);
+	return 0;
+}
+
+/**
+ * Write a register table, merging runs of consecutive addresses into
+ * bursts of up to OV5640_BURST_MAX registers.
+ * @sd: subdev of the sensor.
+ * @reglist[]: List of address of the registers to write data.
+ * @size: Number of entries in @reglist.
+ * Returns zero if successful, or non-zero otherwise.
+ */
+static int ov540_block_writes(struct v4l2_subdev *sd, const struct ov5640_reg reglist[],int size)
+{
+	u8 data[OV5640_BURST_MAX];
+	u16 startaddr = 0;
+	unsigned int length = 0;
+	int err = 0, i;
+
+	trace_ov5640_table_start(reglist, size);
+	for (i = 0; i < size; i++) {
+		if (length && (reglist[i].reg != startaddr + length ||
+				length == OV5640_BURST_MAX)) {
+			err = ov5640_burst_write(sd, startaddr, data, length);
+			if (err)
+				goto out;
+			ov5640_mdelay(1);
+			length = 0;
+		}
+
+		if (!length)
+			startaddr = reglist[i].reg;
+		data[length++] = reglist[i].val;
+	}
+
+	if (length) {
+		err = ov5640_burst_write(sd, startaddr, data, length);
+		if (!err)
+			ov5640_mdelay(1);
+	}
+out:
+	trace_ov5640_table_end(reglist, err);
+	return err;
+}
+
+static void ov5640_seq_delay(unsigned int us)
+{
+	trace_ov5640_delay(us);
+	if (us < 10)
+		udelay(us);
+	else if (us < 20000)
+		usleep_range(us, us + us / 4);
+	else
+		msleep(DIV_ROUND_UP(us, 1000));
+}
+
+static int ov5640_seq_poll(struct v4l2_subdev *sd, const struct ov5640_seq *s)
+{
+	unsigned long timeout = jiffies + msecs_to_jiffies(s->arg);
+	unsigned int us = OV5640_SEQ_POLL_MIN_US;
+	u8 val;
+	int err;
+
+	for (;;) {
+		err = ov5640_reg_read(sd, s->reg, &val);
+		if (err)
+			return err;
+		if (((val & s->mask) == s->val) == (s->op == OV5640_SEQ_OP_POLL))
+			return 0;
+		if (time_after(jiffies, timeout))
+			break;
+
+		ov5640_seq_delay(us);
+		us = min(us * 2, OV5640_SEQ_POLL_MAX_US);
+	}
+
+	ov5640_dbg(sd, OV5640_DBG_I2C, "%s: 0x%04x stuck at 0x%02x\n",
+		__func__, s->reg, val);
+	return -ETIMEDOUT;
+}
+
+/*
+ * Run @n sequence steps. Pending writes are flushed as one burst before
+ * any step that is not a write to the next register.
+ */
+static int ov5640_run_seq(struct v4l2_subdev *sd, const struct ov5640_seq *seq,
+			int n)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	u8 data[OV5640_BURST_MAX];
+	unsigned int length = 0, off, chunk;
+	u16 startaddr = 0;
+	const struct ov5640_seq *s;
+	u8 val;
+	int err = 0;
+
+	trace_ov5640_table_start(seq, n);
+	for (s = seq; s < seq + n; s++) {
+		if (length && ((s->op != OV5640_SEQ_OP_WRITE &&
+				s->op != OV5640_SEQ_OP_MASK) ||
+				s->reg != startaddr + length ||
+				length == OV5640_BURST_MAX)) {
+			err = ov5640_burst_write(sd, startaddr, data, length);
+			if (err)
+				goto out;
+			length = 0;
+		}
+
+		switch (s->op) {
+		case OV5640_SEQ_OP_WRITE:
+			val = s->val;
+			break;
+		case OV5640_SEQ_OP_MASK:
+			if (!ov5640_shadow_get(state, s->reg, &val)) {
+				err = ov5640_reg_read(sd, s->reg, &val);
+				if (err)
+					goto out;
+			}
+			val = (val & ~s->mask) | (s->val & s->mask);
+			break;
+		case OV5640_SEQ_OP_BURST:
+			for (off = 0; off < s->arg; off += chunk) {
+				chunk = min_t(unsigned int, s->arg - off,
+						OV5640_BURST_MAX);
+				err = ov5640_burst_write(sd, s->reg + off,
+						s->data + off, chunk);
+				if (err)
+					goto out;
+			}
+			continue;
+		case OV5640_SEQ_OP_DELAY:
+			ov5640_seq_delay(s->arg);
+			continue;
+		case OV5640_SEQ_OP_POLL:
+		case OV5640_SEQ_OP_POLL_NE:
+			err = ov5640_seq_poll(sd, s);
+			if (err)
+				goto out;
+			continue;
+		default:
+			err = -EINVAL;
+			goto out;
+		}
+
+		if (!length)
+			startaddr = s->reg;
+		data[length++] = val;
+	}
+
+	if (length)
+		err = ov5640_burst_write(sd, startaddr, data, length);
+out:
+	trace_ov5640_table_end(seq, err);
+	return err;
+}
+
+static char *tuning = "";
+module_param(tuning, charp, S_IRUGO);
+MODULE_PARM_DESC(tuning, "tuning container of the product line, e.g. " OV5640_TUNING_FW ", empty (default) for built-in tables");
+MODULE_FIRMWARE(OV5640_TUNING_FW);
+
+static int ov5640_tuning_check(const struct firmware *fw)
+{
+	const struct ov5640_tuning_header *hdr = (const void *)fw->data;
+	const struct ov5640_tuning_record *rec;
+	size_t off, len, size;
+	unsigned int n = 0;
+
+	if (fw->size < sizeof(*hdr) ||
+			le32_to_cpu(hdr->magic) != OV5640_TUNING_MAGIC ||
+			le16_to_cpu(hdr->version) != OV5640_TUNING_VERSION)
+		return -EINVAL;
+
+	size = le32_to_cpu(hdr->size);
+	if (size != fw->size - sizeof(*hdr))
+		return -EINVAL;
+	if ((crc32_le(~0, fw->data + sizeof(*hdr), size) ^ ~0) !=
+			le32_to_cpu(hdr->crc))
+		return -EBADMSG;
+
+	for (off = sizeof(*hdr); off < fw->size; off += ALIGN(len, 4), n++) {
+		rec = (const void *)(fw->data + off);
+		if (fw->size - off < sizeof(*rec))
+			return -EINVAL;
+		len = sizeof(*rec) + le16_to_cpu(rec->len);
+		if (fw->size - off < len)
+			return -EINVAL;
+	}
+
+	return n == le16_to_cpu(hdr->num_records) ? 0 : -EINVAL;
+}
+
+/*
+ * A missing container is normal. From 3.14 on the lookup skips the
+ * usermode helper; older kernels fall back to it and may wait for
+ * loading_timeout, which is why the container is opt-in and fetched once.
+ */
+static int ov5640_request_tuning(struct i2c_client *client, const char *name,
+				const struct firmware **fw)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 14, 0)
+	return request_firmware_direct(fw, name, &client->dev);
+#else
+	return request_firmware(fw, name, &client->dev);
+#endif
+}
+
+/* the tables ov5640_tuning_run() is asked for */
+static bool ov5640_tuning_kept(u16 table)
+{
+	return table == OV5640_TUNING_INIT || table == OV5640_TUNING_AF_FW;
+}
+
+/*
+ * Keep the records of the tables the driver replays, each padded to 4
+ * bytes as in the container, and drop everything else
+ */
+static int ov5640_tuning_keep(struct s5k4ba_state *state,
+			const struct firmware *fw)
+{
+	const struct ov5640_tuning_record *rec;
+	size_t off, len, total = 0;
+	u8 *recs;
+
+	for (off = sizeof(struct ov5640_tuning_header); off < fw->size;
+			off += ALIGN(len, 4)) {
+		rec = (const void *)(fw->data + off);
+		len = sizeof(*rec) + le16_to_cpu(rec->len);
+		if (ov5640_tuning_kept(le16_to_cpu(rec->table)))
+			total += ALIGN(len, 4);
+	}
+	if (!total)
+		return 0;
+
+	recs = kzalloc(total, GFP_KERNEL);
+	if (!recs)
+		return -ENOMEM;
 
+	state->tuning_recs = recs;
+	state->tuning_len = total;
+	for (off = sizeof(struct ov5640_tuning_header); off < fw->size;
+			off += ALIGN(len, 4)) {
+		rec = (const void *)(fw->data + off);
+		len = sizeof(*rec) + le16_to_cpu(rec->len);
+		if (!ov5640_tuning_kept(le16_to_cpu(rec->table)))
+			continue;
+		memcpy(recs, rec, len);
+		recs += ALIGN(len, 4);
+	}
 	return 0;
 }
 
 /*
- * S5K4BA register structure : 2bytes address, 2bytes value
- * retry on write failure up-to 5 times
+ * Look up the tuning container on the first power-up and keep what
+ * ov5640_tuning_run() needs, so later opens don't pay for
+ * request_firmware. Without it the built-in tables are used.
  */
-static inline int s5k4ba_write(struct v4l2_subdev *sd, u8 addr, u8 val)
+static void ov5640_tuning_load(struct v4l2_subdev *sd)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(sd);
-	struct i2c_msg msg[1];
-	unsigned char reg[2];
-	int err = 0;
-	int retry = 0;
+	struct s5k4ba_state *state = to_state(sd);
+	const struct ov5640_tuning_header *hdr;
+	const struct firmware *fw = NULL;
+	const char *name = tuning;
+	char rev_name[32];
+	int err = -ENOENT;
 
+	if (state->tuning_done)
+		return;
+	state->tuning_done = true;
 
-	if (!client->adapter)
-		return -ENODEV;
+	if (!tuning || !*tuning)
+		return;
+
+	/*
+	 * Asking for the generic name opts in to a container for this
+	 * sensor revision, which wins when present
+	 */
+	if (!strcmp(tuning, OV5640_TUNING_FW)) {
+		snprintf(rev_name, sizeof(rev_name), OV5640_TUNING_REV_FW,
+			state->revision);
+		name = rev_name;
+		err = ov5640_request_tuning(client, name, &fw);
+	}
+	if (err) {
+		name = tuning;
+		err = ov5640_request_tuning(client, name, &fw);
+	}
+	if (err) {
+		ov5640_dbg(sd, OV5640_DBG_MODE, "%s: no %s (%d)\n",
+			__func__, name, err);
+		return;
+	}
+
+	err = ov5640_tuning_check(fw);
+	if (!err)
+		err = ov5640_tuning_keep(state, fw);
+	if (err) {
+		dev_warn(&client->dev, "%s: %s rejected (%d), using built-in tables\n",
+			__func__, name, err);
+	} else {
+		hdr = (const void *)fw->data;
+		ov5640_dbg(sd, OV5640_DBG_MODE, "%s: %s, %u records for %.16s, %zu bytes kept\n",
+			__func__, name, le16_to_cpu(hdr->num_records),
+			hdr->product, state->tuning_len);
+	}
+	release_firmware(fw);
+}
+
+/* stream the records of @table; -ENOENT if the container had none */
+static int ov5640_tuning_run(struct v4l2_subdev *sd, u16 table)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	const struct ov5640_tuning_record *rec;
+	unsigned int off, len, pos, chunk;
+	bool found = false;
+	int err;
+
+	for (off = 0; off < state->tuning_len;
+			off += ALIGN(sizeof(*rec) + len, 4)) {
+		rec = (const void *)(state->tuning_recs + off);
+		len = le16_to_cpu(rec->len);
+		if (le16_to_cpu(rec->table) != table)
+			continue;
+
+		found = true;
+		for (pos = 0; pos < len; pos += chunk) {
+			chunk = min_t(unsigned int, len - pos, OV5640_BURST_MAX);
+			err = ov5640_burst_write(sd, le16_to_cpu(rec->reg) + pos,
+					rec->data + pos, chunk);
+			if (err)
+				return err;
+		}
+		if (rec->delay_us)
+			ov5640_seq_delay(le16_to_cpu(rec->delay_us));
+	}
+
+	return found ? 0 : -ENOENT;
+}
 
-again:
-	msg->addr = client->addr;
-	msg->flags = 0;
-	msg->len = 2;
-	msg->buf = reg;
+/*
+ * Upload the AF MCU firmware to 0x8000, from the tuning container when
+ * it carries one, and start the MCU with the AF_POST settings.
+ */
+static int  ov5640_firmware_download_af(struct v4l2_subdev *sd){
 
-	reg[0] = addr & 0xff;
-	reg[1] = val & 0xff;
+        const u8 *firmwarebuf = OV5640_CAMERA_Module_AF_Init_DATA;
+        unsigned int length = sizeof(OV5640_CAMERA_Module_AF_Init_DATA ); 
+        struct i2c_client *client = v4l2_get_subdevdata(sd);
+        unsigned int offset, chunk;
+        int err = 0; u8 value = 0;
 
-	err = i2c_transfer(client->adapter, msg, 1);
-	if (err >= 0)
-		return err;	/* Returns here on success */
+        err = ov5640_reg_write(sd, 0x3000,0x20);
+        if(err){
+                dev_err(&client->dev, "%s: MCU reset {0x3000,0x20} failed\n",
+                        __func__);
+        }
+        ov5640_mdelay(1);
+        if (ov5640_dbg_on(OV5640_DBG_AF)) {
+                ov5640_reg_read(sd, 0x3000, &value);
+                ov5640_dbg(sd, OV5640_DBG_AF, "firmware download start (%x, %x)\n",
+                        0x3000, value);
+        }
 
-	/* abnormal case: retry 5 times */
-	if (retry < 5) {
-		dev_err(&client->dev, "%s: address: 0x%02x%02x, " \
-			"value: 0x%02x%02x\n", __func__, \
-			reg[0], reg[1], reg[2], reg[3]);
-		retry++;
-		goto again;
+	err = ov5640_tuning_run(sd, OV5640_TUNING_AF_FW);
+	if (err == -ENOENT) {
+		err = 0;
+		for (offset = 0; !err && offset < length; offset += chunk) {
+			chunk = min_t(unsigned int, length - offset,
+					OV5640_BURST_MAX);
+			err = ov5640_burst_write(sd, 0x8000 + offset,
+					firmwarebuf + offset, chunk);
+		}
 	}
+	if (err)
+		return err;
 
-	return err;
+        //err = ov5640_reg_writes(sd, OV5640_CAMERA_Module_AF_POST,
+          //    ARRAY_SIZE(OV5640_CAMERA_Module_AF_POST));
+	err = ov540_block_writes(sd, OV5640_CAMERA_Module_AF_POST,ARRAY_SIZE(OV5640_CAMERA_Module_AF_POST));
+	if (err){
+                dev_err(&client->dev, "%s: OV5640 AF setting failed\n", __func__);
+		return err;
+        }
+
+	return ov5640_run_seq(sd, ov5640_af_boot_seq,
+			ARRAY_SIZE(ov5640_af_boot_seq));
 }
 
 static int s5k4ba_i2c_write(struct v4l2_subdev *sd, unsigned char i2c_data[],
@@ -1235,7 +2422,7 @@ static int s5k4ba_i2c_write(struct v4l2_subdev *sd, unsigned char i2c_data[],
 	for (i = 0; i < length; i++)
 		buf[i] = i2c_data[i];
 
-	return i2c_transfer(client->adapter, &msg, 1) == 1 ? 0 : -EIO;
+	return ov5640_i2c_transfer(sd, &msg, 1) == 1 ? 0 : -EIO;
 }
 
 static int s5k4ba_write_regs(struct v4l2_subdev *sd, unsigned char regs[],
@@ -1273,9 +2460,8 @@ static const char *s5k4ba_querymenu_ev_bias_mode[] = {
 static struct v4l2_queryctrl s5k4ba_controls[] = {
 	{
 		/*
-		 * For now, we just support in preset type
-		 * to be close to generic WB system,
-		 * we define color temp range for each preset
+		 * Manual gains from ov5640_wb_curve, clamped to its range;
+		 * 0 runs the AWB
 		 */
 		.id = V4L2_CID_WHITE_BALANCE_TEMPERATURE,
 		.type = V4L2_CTRL_TYPE_INTEGER,
@@ -1283,7 +2469,7 @@ static struct v4l2_queryctrl s5k4ba_controls[] = {
 		.minimum = 0,
 		.maximum = 10000,
 		.step = 1,
-		.default_value = 0,	/* FIXME */
+		.default_value = 0,
 	},
 	{
 		.id = V4L2_CID_WHITE_BALANCE_PRESET,
@@ -1350,48 +2536,125 @@ static struct v4l2_queryctrl s5k4ba_controls[] = {
 		.step = 1,
 		.default_value = 2,
 	},
-};
-
-const char * const *s5k4ba_ctrl_get_menu(u32 id)
-{
-	switch (id) {
-	case V4L2_CID_WHITE_BALANCE_PRESET:
-		return s5k4ba_querymenu_wb_preset;
-
-	case V4L2_CID_COLORFX:
-		return s5k4ba_querymenu_effect_mode;
-
-	case V4L2_CID_EXPOSURE:
-		return s5k4ba_querymenu_ev_bias_mode;
-
-	default:
-		return v4l2_ctrl_get_menu(id);
-	}
-}
-
-static inline struct v4l2_queryctrl const *s5k4ba_find_qctrl(int id)
-{
-	int i;
-
-	for (i = 0; i < ARRAY_SIZE(s5k4ba_controls); i++)
-		if (s5k4ba_controls[i].id == id)
-			return &s5k4ba_controls[i];
-
-	return NULL;
-}
-
-static int s5k4ba_queryctrl(struct v4l2_subdev *sd, struct v4l2_queryctrl *qc)
-{
-	int i;
-
-	for (i = 0; i < ARRAY_SIZE(s5k4ba_controls); i++) {
-		if (s5k4ba_controls[i].id == qc->id) {
-			memcpy(qc, &s5k4ba_controls[i], \
-				sizeof(struct v4l2_queryctrl));
-			return 0;
-		}
-	}
-
+	{
+		.id = V4L2_CID_OV5640_ZSL,
+		.type = V4L2_CTRL_TYPE_BOOLEAN,
+		.name = "Zero Shutter Lag",
+		.minimum = 0,
+		.maximum = 1,
+		.step = 1,
+		.default_value = 0,
+	},
+	{
+		.id = V4L2_CID_OV5640_CAPTURE_ARM,
+		.type = V4L2_CTRL_TYPE_BUTTON,
+		.name = "Capture Arm",
+		.minimum = 0,
+		.maximum = 0,
+		.step = 0,
+		.default_value = 0,
+		.flags = V4L2_CTRL_FLAG_WRITE_ONLY,
+	},
+	{
+		.id = V4L2_CID_OV5640_VCM_POSITION,
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.name = "VCM Position",
+		.minimum = 0,
+		.maximum = 1023,
+		.step = 1,
+		.default_value = 0,
+		.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	},
+	{
+		.id = V4L2_CID_FOCUS_ABSOLUTE,
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.name = "Focus, Absolute",
+		.minimum = 0,
+		.maximum = 1023,
+		.step = 1,
+		.default_value = 0,
+	},
+	{
+		.id = V4L2_CID_OV5640_NIGHT_MIN_FPS,
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.name = "Night Mode Minimum FPS",
+		.minimum = 0,
+		.maximum = 30,
+		.step = 1,
+		.default_value = 0,
+	},
+	{
+		/* auto lets the sensor detect the mains frequency */
+		.id = V4L2_CID_POWER_LINE_FREQUENCY,
+		.type = V4L2_CTRL_TYPE_MENU,
+		.name = "Power Line Frequency",
+		.minimum = OV5640_BANDING_OFF,
+		.maximum = OV5640_POWER_LINE_MAX,
+		.step = 1,
+		.default_value = OV5640_POWER_LINE_MAX,
+	},
+#ifdef V4L2_CID_3A_LOCK
+	{
+		.id = V4L2_CID_3A_LOCK,
+		.type = V4L2_CTRL_TYPE_BITMASK,
+		.name = "3A Lock",
+		.minimum = 0,
+		.maximum = V4L2_LOCK_EXPOSURE | V4L2_LOCK_WHITE_BALANCE,
+		.step = 0,
+		.default_value = 0,
+	},
+#endif
+	{
+		.id = V4L2_CID_OV5640_FOCUS_DISTANCE,
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.name = "Focus Distance (mm)",
+		.minimum = 0,
+		.maximum = 100000,
+		.step = 1,
+		.default_value = 0,
+	},
+};
+
+const char * const *s5k4ba_ctrl_get_menu(u32 id)
+{
+	switch (id) {
+	case V4L2_CID_WHITE_BALANCE_PRESET:
+		return s5k4ba_querymenu_wb_preset;
+
+	case V4L2_CID_COLORFX:
+		return s5k4ba_querymenu_effect_mode;
+
+	case V4L2_CID_EXPOSURE:
+		return s5k4ba_querymenu_ev_bias_mode;
+
+	default:
+		return v4l2_ctrl_get_menu(id);
+	}
+}
+
+static inline struct v4l2_queryctrl const *s5k4ba_find_qctrl(int id)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(s5k4ba_controls); i++)
+		if (s5k4ba_controls[i].id == id)
+			return &s5k4ba_controls[i];
+
+	return NULL;
+}
+
+static int s5k4ba_queryctrl(struct v4l2_subdev *sd, struct v4l2_queryctrl *qc)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(s5k4ba_controls); i++) {
+		if (s5k4ba_controls[i].id == qc->id) {
+			memcpy(qc, &s5k4ba_controls[i], \
+				sizeof(struct v4l2_queryctrl));
+			return 0;
+		}
+	}
+
 	return -EINVAL;
 }
 
@@ -1409,13 +2672,29 @@ static int s5k4ba_querymenu(struct v4l2_subdev *sd, struct v4l2_querymenu *qm)
  * Clock configuration
  * Configure expected MCLK from host and return EINVAL if not supported clock
  * frequency is expected
- *	freq : in Hz
+ *	freq : in Hz, 6MHz to 27MHz
  *	flag : not supported for now
  */
 static int s5k4ba_s_crystal_freq(struct v4l2_subdev *sd, u32 freq, u32 flags)
 {
-	int err = -EINVAL;
+	struct s5k4ba_state *state = to_state(sd);
+	int err;
 
+	/* a running init would mix the two clocks in the shadow */
+	flush_work(&state->init_work);
+	mutex_lock(&state->ctrl_lock);
+
+	err = ov5640_set_mclk(state, freq / 1000);
+	if (err)
+		goto out;
+
+	/* the PLL in the shadow was retuned for the old clock */
+	ov5640_shadow_reset(state);
+	state->active.mode = NULL;
+	ov5640_dbg(sd, OV5640_DBG_MODE, "%s: MCLK %u kHz, pre-divider %u\n",
+		__func__, state->freq, state->pll_prediv);
+out:
+	mutex_unlock(&state->ctrl_lock);
 	return err;
 }
 
@@ -1431,16 +2710,18 @@ static int ov5640_enum_framesizes(struct v4l2_subdev *sd, \
         * In case of image capture,
         * this returns the default camera resolution (VGA)
         */ 
-	printk("\n  <<<< Enumerating sensor capture width and height !!!");
+	ov5640_dbg(sd, OV5640_DBG_MODE, "%s: mycapture = %d\n", __func__,
+		mycapture);
 
-		
 	if(mycapture == 1 ) {
-		printk("\n  <<<< Enumerating sensor capture width and height !!! mycapture = 1");
 		fsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
         	fsize->discrete.width = 2592;////2048;
         	fsize->discrete.height = 1936;//1536;
+	} else if (state->pending.mode) {
+		fsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+		fsize->discrete.width = state->pending.mode->width;
+		fsize->discrete.height = state->pending.mode->height;
 	}else{
-		printk("\n  <<<< Enumerating sensor capture width and height mycapture = 0");
 		fsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
                 fsize->discrete.width = 640;
                 fsize->discrete.height = 480;
@@ -1450,236 +2731,1517 @@ static int ov5640_enum_framesizes(struct v4l2_subdev *sd, \
  
 	mycapture = 0;
 
-        return 0;
+        return 0;
+
+}
+static void ov5640_af_cache_update(struct s5k4ba_state *state,
+					u8 cmd_ack, u8 focus_status)
+{
+	spin_lock(&state->af_lock);
+	state->af_cache.cmd_ack = cmd_ack;
+	state->af_cache.focus_status = focus_status;
+	state->af_cache.stamp = jiffies;
+	state->af_cache.valid = true;
+	spin_unlock(&state->af_lock);
+}
+
+/* a new AF command was issued, the next poll has to hit the sensor */
+static void ov5640_af_cache_invalidate(struct s5k4ba_state *state)
+{
+	spin_lock(&state->af_lock);
+	state->af_cache.valid = false;
+	state->af_cache.settled = false;
+	spin_unlock(&state->af_lock);
+}
+
+static void ov5640_set_af_cached(struct s5k4ba_state *state, bool cached)
+{
+	spin_lock(&state->af_lock);
+	state->af_cached = cached;
+	spin_unlock(&state->af_lock);
+}
+
+static bool ov5640_af_cache_fresh(struct s5k4ba_state *state)
+{
+	return state->af_cache.valid &&
+		time_before(jiffies, state->af_cache.stamp +
+			msecs_to_jiffies(state->one_frame_delay_ms));
+}
+
+/*
+ * The AF firmware is uploaded in the background by ov5640_init_work();
+ * every AF request waits here until it is on the sensor.
+ */
+static int ov5640_wait_af_ready(struct v4l2_subdev *sd)
+{
+	struct s5k4ba_state *state = to_state(sd);
+
+	if (!wait_for_completion_timeout(&state->af_ready,
+			msecs_to_jiffies(OV5640_AF_FW_TIMEOUT_MS)))
+		return -ETIMEDOUT;
+
+	return state->af_err;
+}
+
+static void ov5640_config_timing(const struct ov5640_config *cfg,
+				u32 *hts, u32 *vts);
+
+/*
+ * Refresh the AF status cache from the sensor in one bus transaction.
+ * 0x3028 is only meaningful once the MCU has acknowledged the command
+ * in 0x3023. The frame length, night mode dummy lines included, comes
+ * along so the cache lifetime follows stretched frames.
+ */
+static int ov5640_af_cache_refresh(struct v4l2_subdev *sd)
+{
+	static const u16 regs[] = {
+		0x3023, 0x3028, 0x380E, 0x380F,
+		OV5640_REG_AEC_VTS_EXTRA, OV5640_REG_AEC_VTS_EXTRA + 1,
+	};
+	struct s5k4ba_state *state = to_state(sd);
+	u8 vals[ARRAY_SIZE(regs)];
+	u32 hts, vts;
+	int ret;
+
+	ret = ov5640_reg_read_batch(sd, regs, vals, ARRAY_SIZE(regs));
+	if (ret)
+		return ret;
+
+	if (state->active.mode && state->pclk_khz) {
+		ov5640_config_timing(&state->active, &hts, &vts);
+		vts = ((vals[2] << 8) | vals[3]) + ((vals[4] << 8) | vals[5]);
+		if (hts && vts)
+			state->one_frame_delay_ms =
+				DIV_ROUND_UP(hts * vts, state->pclk_khz);
+	}
+
+	ov5640_af_cache_update(state, vals[0], vals[1]);
+	return 0;
+}
+
+/* VCM DAC code, D[9:4] in 0x3603[5:0] and D[3:0] in 0x3602[7:4] */
+static int ov5640_read_vcm(struct v4l2_subdev *sd, u16 *dac)
+{
+	u8 buf[2];
+	int err;
+
+	err = ov5640_reg_read_multi(sd, 0x3602, buf, 2);
+	if (err)
+		return err;
+
+	*dac = ((buf[1] & 0x3f) << 4) | (buf[0] >> 4);
+	return 0;
+}
+
+static struct ov5640_focus_entry *
+ov5640_focus_lookup(struct s5k4ba_state *state, u32 distance_mm)
+{
+	int i;
+
+	for (i = 0; i < OV5640_FOCUS_CACHE_SIZE; i++)
+		if (state->focus_cache[i].distance_mm == distance_mm)
+			return &state->focus_cache[i];
+	return NULL;
+}
+
+/* remember @dac for @distance_mm, replacing the least recently used entry */
+static void ov5640_focus_store(struct s5k4ba_state *state, u32 distance_mm,
+				u16 dac)
+{
+	struct ov5640_focus_entry *e;
+	int i;
+
+	e = ov5640_focus_lookup(state, distance_mm);
+	if (!e)
+		e = ov5640_focus_lookup(state, 0);
+	if (!e) {
+		e = &state->focus_cache[0];
+		for (i = 1; i < OV5640_FOCUS_CACHE_SIZE; i++)
+			if (time_before(state->focus_cache[i].stamp, e->stamp))
+				e = &state->focus_cache[i];
+	}
+
+	e->distance_mm = distance_mm;
+	e->dac = dac;
+	e->stamp = jiffies;
+}
+
+/*
+ * called by HAL after auto focus was started to get the first search result.
+ * The HAL polls this in a loop, so it is served from the AF status cache and
+ * touches I2C at most once per frame period.
+ */
+static int ov5640_get_auto_focus_result_first(struct v4l2_subdev *sd,
+                                        struct v4l2_control *ctrl)
+{
+        struct i2c_client *client = v4l2_get_subdevdata(sd);
+        struct s5k4ba_state *state =
+                container_of(sd, struct s5k4ba_state, sd);
+        int ret = 0;
+	u16 dac;
+
+	/* the lens went straight to a cached position */
+	if (state->af_cached) {
+		ctrl->value = AUTO_FOCUS_DONE;
+		return 0;
+	}
+
+        if (state->af_status == AF_INITIAL) {
+                dev_dbg(&client->dev, "%s: Check AF Result\n", __func__);
+                ov5640_set_af_status(state, AF_START);
+        } else if (state->af_status == AF_CANCEL) {
+                dev_dbg(&client->dev,
+                        "%s: AF is cancelled while doing\n", __func__) ;
+                ctrl->value = AUTO_FOCUS_CANCELLED;
+                return 0;
+        }
+
+	if (!ov5640_af_cache_fresh(state)) {
+		ret = ov5640_af_cache_refresh(sd);
+		if (ret) {
+			dev_err(&client->dev,
+				"%s: failed to read auto focus result\n",
+				__func__);
+			ctrl->value = 0;
+			return 0;
+		}
+	}
+
+	if (state->af_cache.cmd_ack == 0x01)
+		ctrl->value = 0x01; //Robin Need to check it .
+	else
+		ctrl->value = state->af_cache.focus_status;
+
+	/* the search is over, drop the AF assist flash once */
+	if (state->af_cache.cmd_ack != 0x01 && state->flash_on) {
+		as3643_flash_off();
+		state->flash_on = false;
+	}
+
+	if (state->af_cache.cmd_ack != 0x01 && ktime_to_ns(state->af_start)) {
+		ov5640_stats_latency(state, OV5640_LAT_AF, state->af_start);
+		state->af_start = ktime_set(0, 0);
+
+		/* a search at a known distance need not run again */
+		if (state->focus_distance_mm && state->af_cache.focus_status &&
+				!ov5640_read_vcm(sd, &dac))
+			ov5640_focus_store(state, state->focus_distance_mm, dac);
+	}
+
+	/* nothing is left to do for this search, see ov5640_af_result_cached */
+	if (state->af_cache.cmd_ack != 0x01) {
+		spin_lock(&state->af_lock);
+		state->af_cache.settled = true;
+		spin_unlock(&state->af_lock);
+	}
+
+	dev_dbg(&client->dev, "%s: 0x3023 = 0x%x, 0x3028 = 0x%x\n", __func__,
+		state->af_cache.cmd_ack, state->af_cache.focus_status);
+
+        return 0;
+}
+
+/*
+ * The HAL poll without ctrl_lock: a cached lens position, a search still
+ * running or one whose end was already handled is answered from the AF
+ * status cache. False sends the poll down the locked path.
+ */
+static bool ov5640_af_result_cached(struct s5k4ba_state *state,
+				struct v4l2_control *ctrl)
+{
+	bool hit = true;
+
+	spin_lock(&state->af_lock);
+	if (state->af_cached)
+		ctrl->value = AUTO_FOCUS_DONE;
+	else if (state->af_status == AF_START &&
+			ov5640_af_cache_fresh(state) &&
+			state->af_cache.cmd_ack == 0x01)
+		ctrl->value = 0x01;
+	else if (state->af_status == AF_START &&
+			ov5640_af_cache_fresh(state) && state->af_cache.settled)
+		ctrl->value = state->af_cache.focus_status;
+	else
+		hit = false;
+	spin_unlock(&state->af_lock);
+	return hit;
+}
+
+static int s5k4ba_enum_frameintervals(struct v4l2_subdev *sd,
+					struct v4l2_frmivalenum *fival)
+{
+	int err = 0;
+
+	return err;
+}
+
+static int ov5640_set_flash_mode(struct v4l2_subdev *sd, int value)
+{
+        struct s5k4ba_state *state =
+                container_of(sd, struct s5k4ba_state, sd);
+        struct sec_cam_parm *parms =
+                (struct sec_cam_parm *)&state->strm.parm.raw_data;
+	/*
+        if (parms->flash_mode == value)
+                return 0;
+
+        if ((value >= FLASH_MODE_OFF) && (value <= FLASH_MODE_TORCH)) {
+                pr_debug("%s: setting flash mode to %d\n",
+                        __func__, value);
+                parms->flash_mode = value;
+                if (parms->flash_mode == FLASH_MODE_TORCH)
+                        s5k4ecgx_enable_torch(sd);
+                else
+                        s5k4ecgx_disable_torch(sd);
+                return 0;
+        }
+
+        */
+
+        if ((value >= FLASH_MODE_OFF) && (value <= FLASH_MODE_TORCH)) {
+                ov5640_dbg(sd, OV5640_DBG_CTRL, "%s: setting flash mode to %d (was %d)\n",
+                        __func__, value, parms->flash_mode);
+                if (value == FLASH_MODE_TORCH) {
+			if (parms->flash_mode !=FLASH_MODE_OFF)
+                        	as3643_torch_mode_on();
+                } else {
+                        as3643_torch_off();
+		}
+                return 0;
+        }
+
+
+        ov5640_dbg(sd, OV5640_DBG_CTRL, "%s: trying to set invalid flash mode %d\n",
+                __func__, value);
+        return -EINVAL;
+}
+
+static int ov5640_set_focus_mode(struct v4l2_subdev *sd, int value);
+
+static int ov5640_s_parm(struct v4l2_subdev *sd, struct v4l2_streamparm *param)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	int err = 0;
+
+	struct s5k4ba_state *state =
+                container_of(sd, struct s5k4ba_state, sd);
+        struct sec_cam_parm *new_parms =
+                (struct sec_cam_parm *)&param->parm.raw_data;
+        struct sec_cam_parm *parms =
+                (struct sec_cam_parm *)&state->strm.parm.raw_data;
+
+	dev_dbg(&client->dev, "%s: numerator %d, denominator: %d\n", \
+		__func__, param->parm.capture.timeperframe.numerator, \
+		param->parm.capture.timeperframe.denominator); 
+
+	/* the init worker holds ctrl_lock until the base config is out */
+	wait_for_completion(&state->base_done);
+	mutex_lock(&state->ctrl_lock);
+
+	/* applied with the next config flush */
+	if (param->parm.capture.timeperframe.numerator &&
+			param->parm.capture.timeperframe.denominator)
+		state->pending.fps =
+			param->parm.capture.timeperframe.denominator /
+			param->parm.capture.timeperframe.numerator;
+	
+	err = ov5640_set_flash_mode(sd, new_parms->flash_mode);
+	if (err)
+		goto out;
+
+	/* Must delay 150ms before setting macro mode due to a camera
+         * sensor requirement */
+        if ((new_parms->focus_mode == FOCUS_MODE_MACRO) &&
+                        (parms->focus_mode != FOCUS_MODE_MACRO))
+                ov5640_msleep(150);
+        err = ov5640_set_focus_mode(sd, new_parms->focus_mode);
+	if (!err)
+		parms->focus_mode = new_parms->focus_mode;
+out:
+	mutex_unlock(&state->ctrl_lock);
+	return err;
+}
+
+/* gains the AWB has settled on, R/G/B with 12 bits each, MSB first */
+#define OV5640_REG_AWB_CURRENT		0x519f
+
+/*
+ * Freeze AEC/AGC (0x3503[1:0]) on the exposure and gain in use. The
+ * manual registers are the ones the AEC reports through, they are
+ * written back so nothing moves when the sensor switches over.
+ */
+static int ov5640_set_ae_lock(struct v4l2_subdev *sd, bool lock)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	u8 expo[3] = { 0 }, gain[2] = { 0 };
+	int err;
+
+	/* a bracketing sequence owns 0x3503 until it restores it */
+	if (state->bracket)
+		return -EBUSY;
+
+	if (lock) {
+		err = ov5640_reg_read_multi(sd, 0x3500, expo, sizeof(expo));
+		if (!err)
+			err = ov5640_reg_read_multi(sd, 0x350A, gain,
+					sizeof(gain));
+		if (err)
+			return err;
+	}
+
+	{
+		const struct ov5640_seq seq[] = {
+			OV5640_SEQ_MASK(0x3503, 0x03, lock ? 0x03 : 0x00),
+			OV5640_SEQ_W(0x3500, expo[0]),
+			OV5640_SEQ_W(0x3501, expo[1]),
+			OV5640_SEQ_W(0x3502, expo[2]),
+			OV5640_SEQ_W(0x350A, gain[0]),
+			OV5640_SEQ_W(0x350B, gain[1]),
+		};
+
+		err = ov5640_run_seq(sd, seq, lock ? ARRAY_SIZE(seq) : 1);
+	}
+	if (!err)
+		state->userset.ae_lock = lock;
+	return err;
+}
+
+/* freeze AWB (0x3406[0]) with the current gains as manual gains */
+static int ov5640_set_awb_lock(struct v4l2_subdev *sd, bool lock)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	u8 gains[6] = { 0 };
+	int err;
+
+	if (state->bracket)
+		return -EBUSY;
+
+	if (lock) {
+		err = ov5640_reg_read_multi(sd, OV5640_REG_AWB_CURRENT, gains,
+				sizeof(gains));
+		if (err)
+			return err;
+	}
+
+	{
+		const struct ov5640_seq seq[] = {
+			OV5640_SEQ_W(0x3400, gains[0]),
+			OV5640_SEQ_W(0x3401, gains[1]),
+			OV5640_SEQ_W(0x3402, gains[2]),
+			OV5640_SEQ_W(0x3403, gains[3]),
+			OV5640_SEQ_W(0x3404, gains[4]),
+			OV5640_SEQ_W(0x3405, gains[5]),
+			OV5640_SEQ_MASK(0x3406, 0x01, lock ? 0x01 : 0x00),
+		};
+
+		err = lock ? ov5640_run_seq(sd, seq, ARRAY_SIZE(seq)) :
+			ov5640_run_seq(sd, &seq[6], 1);
+	}
+	if (!err)
+		state->userset.awb_lock = lock;
+	if (!err && !lock) {
+		state->userset.auto_wb = 1;
+		state->userset.wb_temp = 0;
+	}
+	return err;
+}
+
+/*
+ * Manual R/G/B gains (0x3400-0x3405, 0x400 == 1x) along the colour
+ * temperature, from the OV5640 reference home, office, sunny and cloudy
+ * settings. Temperatures in between are interpolated linearly.
+ */
+static const struct ov5640_wb_point {
+	u16 kelvin;
+	u16 r, g, b;
+} ov5640_wb_curve[] = {
+	{ 2800, 0x410, 0x400, 0x8b6 },
+	{ 4000, 0x548, 0x400, 0x7cf },
+	{ 5500, 0x61c, 0x400, 0x4f3 },
+	{ 6500, 0x648, 0x400, 0x4d3 },
+};
+
+/* in the order of s5k4ba_querymenu_wb_preset */
+static const u16 ov5640_wb_preset_kelvin[] = { 2800, 4000, 5500, 6500 };
+
+static u16 ov5640_wb_interp(u16 lo, u16 hi, int pos, int span)
+{
+	return lo + ((int)hi - lo) * pos / span;
+}
+
+/* manual gains for @kelvin and AWB off, in a single burst */
+static int ov5640_set_wb_temperature(struct v4l2_subdev *sd, int kelvin)
+{
+	const struct ov5640_wb_point *lo, *hi;
+	struct s5k4ba_state *state = to_state(sd);
+	u16 r, g, b;
+	int i, pos, span, err;
+
+	if (state->bracket)
+		return -EBUSY;
+
+	kelvin = clamp_t(int, kelvin, ov5640_wb_curve[0].kelvin,
+		ov5640_wb_curve[ARRAY_SIZE(ov5640_wb_curve) - 1].kelvin);
+	for (i = 1; i < ARRAY_SIZE(ov5640_wb_curve) - 1; i++)
+		if (kelvin <= ov5640_wb_curve[i].kelvin)
+			break;
+	lo = &ov5640_wb_curve[i - 1];
+	hi = &ov5640_wb_curve[i];
+	pos = kelvin - lo->kelvin;
+	span = hi->kelvin - lo->kelvin;
+
+	r = ov5640_wb_interp(lo->r, hi->r, pos, span);
+	g = ov5640_wb_interp(lo->g, hi->g, pos, span);
+	b = ov5640_wb_interp(lo->b, hi->b, pos, span);
+
+	{
+		const struct ov5640_seq seq[] = {
+			OV5640_SEQ_W(0x3400, r >> 8),
+			OV5640_SEQ_W(0x3401, r & 0xff),
+			OV5640_SEQ_W(0x3402, g >> 8),
+			OV5640_SEQ_W(0x3403, g & 0xff),
+			OV5640_SEQ_W(0x3404, b >> 8),
+			OV5640_SEQ_W(0x3405, b & 0xff),
+			OV5640_SEQ_MASK(0x3406, 0x01, 0x01),
+		};
+
+		err = ov5640_run_seq(sd, seq, ARRAY_SIZE(seq));
+	}
+	if (err)
+		return err;
+
+	ov5640_dbg(sd, OV5640_DBG_CTRL, "%s: %dK R/G/B 0x%03x/0x%03x/0x%03x\n",
+		__func__, kelvin, r, g, b);
+	state->userset.wb_temp = kelvin;
+	state->userset.auto_wb = 0;
+	state->userset.awb_lock = 0;
+	return 0;
+}
+
+static int ov5640_set_auto_wb(struct v4l2_subdev *sd, bool on)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	const struct ov5640_seq seq[] = {
+		OV5640_SEQ_MASK(0x3406, 0x01, on ? 0x00 : 0x01),
+	};
+	int err;
+
+	if (state->bracket)
+		return -EBUSY;
+
+	err = ov5640_run_seq(sd, seq, ARRAY_SIZE(seq));
+	if (!err && on) {
+		state->userset.auto_wb = 1;
+		state->userset.wb_temp = 0;
+		state->userset.awb_lock = 0;
+	}
+	return err;
+}
+
+/* Samsung white balance menu */
+static int ov5640_set_white_balance(struct v4l2_subdev *sd, int value)
+{
+	switch (value) {
+	case WHITE_BALANCE_AUTO:
+		return ov5640_set_auto_wb(sd, true);
+	case WHITE_BALANCE_TUNGSTEN:
+		return ov5640_set_wb_temperature(sd, ov5640_wb_preset_kelvin[0]);
+	case WHITE_BALANCE_FLUORESCENT:
+		return ov5640_set_wb_temperature(sd, ov5640_wb_preset_kelvin[1]);
+	case WHITE_BALANCE_SUNNY:
+		return ov5640_set_wb_temperature(sd, ov5640_wb_preset_kelvin[2]);
+	case WHITE_BALANCE_CLOUDY:
+		return ov5640_set_wb_temperature(sd, ov5640_wb_preset_kelvin[3]);
+	}
+	return -EINVAL;
+}
+
+static int ov5640_get_vcm_position(struct v4l2_subdev *sd,
+				struct v4l2_control *ctrl)
+{
+	u16 dac;
+	int err;
+
+	err = ov5640_read_vcm(sd, &dac);
+	if (!err)
+		ctrl->value = dac;
+	return err;
+}
+
+/* called with ctrl_lock held whenever the published values may change */
+static void ov5640_ctrl_publish(struct s5k4ba_state *state)
+{
+	struct sec_cam_parm *parms =
+		(struct sec_cam_parm *)&state->strm.parm.raw_data;
+
+	write_seqlock(&state->ctrl_seq);
+	state->snap.white_balance = parms->white_balance;
+	state->snap.effects = parms->effects;
+	state->snap.contrast = parms->contrast;
+	state->snap.saturation = parms->saturation;
+	state->snap.sharpness = parms->sharpness;
+	state->snap.exposure_bias = state->userset.exposure_bias;
+	state->snap.zsl = state->zsl;
+	state->snap.focus_distance_mm = state->focus_distance_mm;
+	state->snap.flash = state->flash_state_on_previous_capture;
+	state->snap.ae_lock = state->userset.ae_lock;
+	state->snap.awb_lock = state->userset.awb_lock;
+	state->snap.wb_temp = state->userset.wb_temp;
+	state->snap.banding = state->userset.banding;
+	state->snap.night_fps = state->userset.night_fps;
+	write_sequnlock(&state->ctrl_seq);
+}
+
+/* answer @ctrl from the published values, false if it needs the sensor */
+static bool ov5640_g_ctrl_snap(struct s5k4ba_state *state,
+				struct v4l2_control *ctrl)
+{
+	struct ov5640_ctrl_snap snap;
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&state->ctrl_seq);
+		snap = state->snap;
+	} while (read_seqretry(&state->ctrl_seq, seq));
+
+	switch (ctrl->id) {
+	case V4L2_CID_CAMERA_WHITE_BALANCE:
+		ctrl->value = snap.white_balance;
+		break;
+	case V4L2_CID_CAMERA_EFFECT:
+		ctrl->value = snap.effects;
+		break;
+	case V4L2_CID_CAMERA_CONTRAST:
+		ctrl->value = snap.contrast;
+		break;
+	case V4L2_CID_CAMERA_SATURATION:
+		ctrl->value = snap.saturation;
+		break;
+	case V4L2_CID_CAMERA_SHARPNESS:
+		ctrl->value = snap.sharpness;
+		break;
+	case V4L2_CID_EXPOSURE:
+		ctrl->value = snap.exposure_bias;
+		break;
+	case V4L2_CID_OV5640_ZSL:
+		ctrl->value = snap.zsl;
+		break;
+	case V4L2_CID_OV5640_FOCUS_DISTANCE:
+		ctrl->value = snap.focus_distance_mm;
+		break;
+	case V4L2_CID_CAMERA_EXIF_FLASH:
+		ctrl->value = snap.flash;
+		break;
+	case V4L2_CID_WHITE_BALANCE_TEMPERATURE:
+		ctrl->value = snap.wb_temp;
+		break;
+	case V4L2_CID_CAMERA_AE_LOCK_UNLOCK:
+		ctrl->value = snap.ae_lock ? AE_LOCK : AE_UNLOCK;
+		break;
+	case V4L2_CID_CAMERA_AWB_LOCK_UNLOCK:
+		ctrl->value = snap.awb_lock ? AWB_LOCK : AWB_UNLOCK;
+		break;
+	case V4L2_CID_POWER_LINE_FREQUENCY:
+		ctrl->value = snap.banding;
+		break;
+	case V4L2_CID_OV5640_NIGHT_MIN_FPS:
+		ctrl->value = snap.night_fps;
+		break;
+	case V4L2_CID_CAMERA_ANTI_BANDING:
+		ctrl->value = ov5640_anti_banding[snap.banding];
+		break;
+#ifdef V4L2_CID_3A_LOCK
+	case V4L2_CID_3A_LOCK:
+		ctrl->value = (snap.ae_lock ? V4L2_LOCK_EXPOSURE : 0) |
+			(snap.awb_lock ? V4L2_LOCK_WHITE_BALANCE : 0);
+		break;
+#endif
+	case V4L2_CID_CAM_DATE_INFO_YEAR:
+		ctrl->value = 2013;
+		break;
+	case V4L2_CID_CAM_DATE_INFO_MONTH:
+	case V4L2_CID_CAM_DATE_INFO_DATE:
+		ctrl->value = 1;
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+static int ov5640_g_ctrl(struct v4l2_subdev *sd, struct v4l2_control *ctrl)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct s5k4ba_state *state = to_state(sd);
+	int err = -EINVAL; 
+
+	if (ov5640_g_ctrl_snap(state, ctrl))
+		return 0;
+
+	/* plain register reads only need the bus */
+	switch (ctrl->id) {
+	case V4L2_CID_CAMERA_EXIF_ISO:
+		/* TODO Need to implement  Robin Singh*/
+		ctrl->value = ISO_50;
+		return -EINVAL;
+	case V4L2_CID_CAMERA_EXIF_EXPTIME:
+		/* TODO : Robin */
+		return -EINVAL;
+	case V4L2_CID_OV5640_VCM_POSITION:
+	case V4L2_CID_FOCUS_ABSOLUTE:
+		return ov5640_get_vcm_position(sd, ctrl);
+	}
+
+	if (ctrl->id == V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_FIRST &&
+			ov5640_af_result_cached(state, ctrl))
+		return 0;
+
+	/* the AF result advances the AF state machine */
+	mutex_lock(&state->ctrl_lock);
+	switch (ctrl->id) { 
+	case V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_FIRST:
+                err = ov5640_get_auto_focus_result_first(sd, ctrl);
+                break;
+        case V4L2_CID_CAMERA_OBJ_TRACKING_STATUS:
+        case V4L2_CID_CAMERA_SMART_AUTO_STATUS:
+                break;
+	default:
+		dev_err(&client->dev, "%s: no such ctrl\n", __func__);
+		break;
+	}
+
+	mutex_unlock(&state->ctrl_lock);
+	return err;
+}
+
+/* value @reg has once @list and then the shadow are applied */
+static bool ov5640_stage_value(struct s5k4ba_state *state,
+				const struct ov5640_reg *list, int num,
+				u16 reg, u8 *val)
+{
+	while (--num >= 0) {
+		if (list[num].reg == reg) {
+			*val = list[num].val;
+			return true;
+		}
+	}
+	return ov5640_shadow_get(state, reg, val);
+}
+
+/* room in a flush plan for frame rate, 3A lock, banding and MIPI */
+#define OV5640_PLAN_EXTRA	20
+
+/* entries ov5640_plan_banding() adds */
+#define OV5640_BANDING_REGS	9
+
+/* entries ov5640_plan_night() adds */
+#define OV5640_NIGHT_REGS	5
+
+/* add @reg=@val to @plan unless the sensor already has that value */
+static int ov5640_plan_add(struct s5k4ba_state *state, struct ov5640_reg *plan,
+			int num, u16 reg, u8 val, int *elided)
+{
+	u8 cur;
+
+	if (ov5640_stage_value(state, plan, num, reg, &cur) && cur == val) {
+		(*elided)++;
+		return num;
+	}
+	plan[num].reg = reg;
+	plan[num].val = val;
+	return num + 1;
+}
+
+/* 16-bit register pair written by a mode table, MSB at @reg */
+static u32 ov5640_mode_value16(const struct ov5640_mode *mode, u16 reg)
+{
+	u32 val = 0;
+	int i;
+
+	for (i = 0; i < mode->num_regs; i++) {
+		if (mode->regs[i].reg == reg)
+			val = (val & 0xff) | (mode->regs[i].val << 8);
+		else if (mode->regs[i].reg == reg + 1)
+			val = (val & 0xff00) | mode->regs[i].val;
+	}
+	return val;
+}
+
+static u32 ov5640_config_fps(const struct ov5640_config *cfg)
+{
+	if (!cfg->fps || cfg->fps > cfg->mode->fps)
+		return cfg->mode->fps;
+	return cfg->fps;
+}
+
+/* line length and frame length of @cfg, a lower rate stretches VTS */
+static void ov5640_config_timing(const struct ov5640_config *cfg,
+				u32 *hts, u32 *vts)
+{
+	*hts = ov5640_mode_value16(cfg->mode, 0x380C);
+	*vts = ov5640_mode_value16(cfg->mode, 0x380E) * cfg->mode->fps /
+		ov5640_config_fps(cfg);
+}
+
+/* step and max band registers are derived, not taken from mode tables */
+static bool ov5640_banding_reg(u16 reg)
+{
+	return (reg >= 0x3A08 && reg <= 0x3A0B) || reg == 0x3A0D ||
+		reg == 0x3A0E;
+}
+
+static u8 ov5640_stage_or(struct s5k4ba_state *state,
+			const struct ov5640_reg *plan, int num, u16 reg, u8 def)
+{
+	u8 val;
+
+	return ov5640_stage_value(state, plan, num, reg, &val) ? val : def;
+}
+
+/*
+ * Banding filter for a line time of @hts pixels. A step is the number of
+ * lines in half a mains period (1/100s or 1/120s), and the AEC may use as
+ * many whole steps as fit in @vts. 0x3A00[5] enables the filter,
+ * 0x3C01[7] selects manual over detected mains frequency and 0x3C00[2]
+ * picks 50Hz for manual.
+ */
+static int ov5640_plan_banding(struct s5k4ba_state *state,
+			struct ov5640_reg *plan, int num, int pclk_khz,
+			u32 hts, u32 vts, int *elided)
+{
+	u32 b50, b60, max50, max60;
+	u8 aec, ctrl00, ctrl01;
+
+	b50 = clamp_t(u32, pclk_khz * 10 / hts, 1, 0x3ff);
+	b60 = clamp_t(u32, pclk_khz * 25 / (3 * hts), 1, 0x3ff);
+	max50 = clamp_t(u32, (vts - 4) / b50, 1, 0x3f);
+	max60 = clamp_t(u32, (vts - 4) / b60, 1, 0x3f);
+
+	aec = ov5640_stage_or(state, plan, num, 0x3A00, 0x78) & ~0x20;
+	ctrl00 = ov5640_stage_or(state, plan, num, 0x3C00, 0x00) & ~0x04;
+	ctrl01 = ov5640_stage_or(state, plan, num, 0x3C01, 0x00) | 0x80;
+	if (state->userset.banding != OV5640_BANDING_OFF)
+		aec |= 0x20;
+	if (state->userset.banding == OV5640_BANDING_AUTO)
+		ctrl01 &= ~0x80;
+	if (state->userset.banding == OV5640_BANDING_50HZ)
+		ctrl00 |= 0x04;
+
+	num = ov5640_plan_add(state, plan, num, 0x3A08, b50 >> 8, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3A09, b50, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3A0A, b60 >> 8, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3A0B, b60, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3A0D, max60, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3A0E, max50, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3A00, aec, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3C00, ctrl00, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3C01, ctrl01, elided);
+	return num;
+}
+
+/* a banding change while a mode is up only touches the banding registers */
+static int ov5640_apply_banding(struct v4l2_subdev *sd)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	struct ov5640_reg plan[OV5640_BANDING_REGS];
+	int num, elided = 0;
+	u32 hts, vts;
+
+	if (!state->active.mode)
+		return 0;
+
+	ov5640_config_timing(&state->active, &hts, &vts);
+	if (!hts || !vts)
+		return 0;
+
+	num = ov5640_plan_banding(state, plan, 0, state->pclk_khz, hts, vts,
+			&elided);
+	return num ? ov540_block_writes(sd, plan, num) : 0;
+}
+
+/*
+ * Night mode (0x3A00[2]) lets the AEC add dummy lines once the exposure
+ * fills the frame. The max exposure, 0x3A02/03 for 60Hz and 0x3A14/15 for
+ * 50Hz, bounds the stretched frame and so the lowest rate.
+ */
+static int ov5640_plan_night(struct s5k4ba_state *state,
+			struct ov5640_reg *plan, int num, u32 fps, u32 vts,
+			int *elided)
+{
+	u32 min_fps = state->userset.night_fps;
+	u32 max_expo = vts;
+	u8 aec;
+
+	aec = ov5640_stage_or(state, plan, num, 0x3A00, 0x78) & ~0x04;
+	if (min_fps && min_fps < fps) {
+		max_expo = min_t(u32, vts * fps / min_fps, 0xffff);
+		aec |= 0x04;
+	}
+
+	num = ov5640_plan_add(state, plan, num, 0x3A00, aec, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3A02, max_expo >> 8, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3A03, max_expo, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3A14, max_expo >> 8, elided);
+	num = ov5640_plan_add(state, plan, num, 0x3A15, max_expo, elided);
+	return num;
+}
+
+static int ov5640_apply_night(struct v4l2_subdev *sd)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	struct ov5640_reg plan[OV5640_NIGHT_REGS];
+	int num, elided = 0;
+	u32 hts, vts;
+
+	if (!state->active.mode)
+		return 0;
+
+	ov5640_config_timing(&state->active, &hts, &vts);
+	if (!vts)
+		return 0;
+
+	num = ov5640_plan_night(state, plan, 0,
+			ov5640_config_fps(&state->active), vts, &elided);
+	return num ? ov540_block_writes(sd, plan, num) : 0;
+}
+
+/* frame interval the sensor runs at now, hts * (VTS + dummy lines) pclks */
+static int ov5640_frame_interval(struct v4l2_subdev *sd,
+				struct v4l2_fract *tpf)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	u8 frame[2], extra[2];
+	u32 hts, vts, num, den, div;
+	int err;
+
+	if (!state->active.mode) {
+		if (!state->pending.mode)
+			return 0;
+		tpf->numerator = 1;
+		tpf->denominator = ov5640_config_fps(&state->pending);
+		return 0;
+	}
+
+	ov5640_config_timing(&state->active, &hts, &vts);
+	if (!hts || !state->pclk_khz) {
+		tpf->numerator = 1;
+		tpf->denominator = ov5640_config_fps(&state->active);
+		return 0;
+	}
+
+	err = ov5640_reg_read_multi(sd, 0x380E, frame, sizeof(frame));
+	if (!err)
+		err = ov5640_reg_read_multi(sd, OV5640_REG_AEC_VTS_EXTRA,
+				extra, sizeof(extra));
+	if (err)
+		return err;
+
+	vts = ((frame[0] << 8) | frame[1]) + ((extra[0] << 8) | extra[1]);
+
+	num = hts * vts;
+	den = state->pclk_khz * 1000;
+	div = gcd(num, den);
+	tpf->numerator = num / div;
+	tpf->denominator = den / div;
+	return 0;
+}
+
+static int ov5640_g_parm(struct v4l2_subdev *sd, struct v4l2_streamparm *param)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	struct v4l2_captureparm *cp = &param->parm.capture;
+	int err;
+
+	if (param->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return -EINVAL;
+
+	mutex_lock(&state->ctrl_lock);
+	param->parm = state->strm.parm;
+	cp->capability |= V4L2_CAP_TIMEPERFRAME;
+	err = ov5640_frame_interval(sd, &cp->timeperframe);
+	mutex_unlock(&state->ctrl_lock);
+
+	return err;
+}
+
+/*
+ * Bring the sensor to state->pending in one go. The plan holds only the
+ * mode table entries the shadow says are not there yet, plus the frame
+ * length for a reduced frame rate and the MIPI timing.
+ */
+static int ov5640_flush_config(struct v4l2_subdev *sd)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct s5k4ba_state *state = to_state(sd);
+	const struct ov5640_mode *mode = state->pending.mode;
+	struct ov5640_reg *plan;
+	int i, num = 0, elided = 0, err = 0;
+	int pclk_khz = mode ? mode->pclk_khz : 0;
+	u32 fps, hts, vts;
+	bool banding;
+	u8 mult;
+
+	if (!mode)
+		return 0;
+
+	fps = ov5640_config_fps(&state->pending);
+	if (mode == state->active.mode &&
+			fps == ov5640_config_fps(&state->active))
+		return 0;
+	/* a new mode would run under the preloaded exposure groups */
+	if (state->bracket)
+		return -EBUSY;
+
+	/* the AF upload may still run, it touches no mode register */
+	wait_for_completion(&state->base_done);
+
+	plan = kmalloc((mode->num_regs + OV5640_PLAN_EXTRA) * sizeof(*plan),
+			GFP_KERNEL);
+	if (!plan)
+		return -ENOMEM;
+
+	if (ov5640_stage_value(state, mode->regs, mode->num_regs,
+			OV5640_REG_PLL_MULT, &mult))
+		pclk_khz = ov5640_pll_pclk(state, mode->pclk_khz, mult);
+
+	ov5640_config_timing(&state->pending, &hts, &vts);
+	banding = hts && vts;
+
+	for (i = 0; i < mode->num_regs; i++) {
+		if (banding && ov5640_banding_reg(mode->regs[i].reg))
+			continue;
+		num = ov5640_plan_add(state, plan, num, mode->regs[i].reg,
+				mode->regs[i].val, &elided);
+	}
+
+	/* mode tables switch 3A back on, a lock has to survive that */
+	if (state->userset.ae_lock)
+		num = ov5640_plan_add(state, plan, num, 0x3503, 0x03, &elided);
+	if (state->userset.awb_lock || state->userset.wb_temp)
+		num = ov5640_plan_add(state, plan, num, 0x3406, 0x01, &elided);
+
+	/*
+	 * A lower rate stretches the frame and AEC may expose all of it,
+	 * in night mode down to the minimum rate
+	 */
+	if (fps < mode->fps) {
+		num = ov5640_plan_add(state, plan, num, 0x380E, vts >> 8, &elided);
+		num = ov5640_plan_add(state, plan, num, 0x380F, vts, &elided);
+	}
+	if (vts)
+		num = ov5640_plan_night(state, plan, num, fps, vts, &elided);
+
+	/* banding steps follow the line time of every new mode */
+	if (banding)
+		num = ov5640_plan_banding(state, plan, num, pclk_khz, hts, vts,
+				&elided);
+
+	/* two lanes, MIPI on; period in ns with one fractional bit */
+	if (state->is_mipi) {
+		num = ov5640_plan_add(state, plan, num,
+				OV5640_REG_IO_MIPI_CTRL00, 0x45, &elided);
+		num = ov5640_plan_add(state, plan, num, OV5640_REG_PCLK_PERIOD,
+				2000000 / pclk_khz, &elided);
+	}
+
+	if (num)
+		err = ov540_block_writes(sd, plan, num);
+	kfree(plan);
+	if (err) {
+		dev_err(&client->dev, "%s: %ux%u@%u failed\n", __func__,
+			mode->width, mode->height, fps);
+		state->active.mode = NULL;
+		return err;
+	}
+
+	atomic_add(elided, &state->stats.elided);
+	ov5640_dbg(sd, OV5640_DBG_MODE, "%s: %ux%u@%u, %d written, %d elided\n",
+		__func__, mode->width, mode->height, fps, num, elided);
+
+	state->active.mode = mode;
+	state->active.fps = fps;
+	state->pclk_khz = pclk_khz;
+	state->one_frame_delay_ms = DIV_ROUND_UP(1000, fps);
+	ov5640_set_runmode(state, mode->runmode);
+	return 0;
+}
+
+/* back to the preview register set after a capture or ZSL */
+static int ov5640_restore_preview(struct v4l2_subdev *sd)
+{
+	struct s5k4ba_state *state = to_state(sd);
+
+	state->pending.mode = OV5640_MODE_PREVIEW;
+	return ov5640_flush_config(sd);
+}
+
+/*
+ * Sample the exposure of the ZSL stream into the metadata ring after a
+ * frame end. The exposure registers are latched at frame start, so what
+ * is read after frame n ends is what frame n + 1 is exposed with.
+ */
+static void ov5640_zsl_work(struct work_struct *work)
+{
+	struct s5k4ba_state *state =
+		container_of(work, struct s5k4ba_state, zsl_work);
+	struct v4l2_subdev *sd = &state->sd;
+	struct ov5640_frame_meta *meta;
+	u8 expo[3], timing[4];
+	u32 lines, hts, vts, seq;
+	unsigned long flags;
+	u16 gain;
+	s64 now;
+	int err;
+
+	/*
+	 * A mode change rewrites these registers under ctrl_lock and may
+	 * cancel this work while holding it; that frame goes unsampled
+	 */
+	if (!mutex_trylock(&state->ctrl_lock))
+		return;
+	if (!state->zsl) {
+		mutex_unlock(&state->ctrl_lock);
+		return;
+	}
 
+	spin_lock_irqsave(&state->bracket_lock, flags);
+	seq = state->frame_seq;
+	spin_unlock_irqrestore(&state->bracket_lock, flags);
+
+	err = ov5640_reg_read_multi(sd, 0x3500, expo, 3) ||
+		ov5640_reg_read16(sd, 0x350A, &gain) ||
+		ov5640_reg_read_multi(sd, 0x380C, timing, 4);
+	mutex_unlock(&state->ctrl_lock);
+	if (err)
+		return;
+
+	now = ktime_to_ns(ktime_get());
+	lines = (((expo[0] & 0x0f) << 16) | (expo[1] << 8) | expo[2]) >> 4;
+	hts = ((timing[0] & 0x1f) << 8) | timing[1];
+	vts = ((timing[2] & 0xff) << 8) | timing[3];
+
+	spin_lock(&state->zsl_lock);
+	meta = &state->zsl_meta[state->zsl_count++ % OV5640_ZSL_META_DEPTH];
+	meta->sequence = seq + 1;
+	meta->exposure_us = div_u64((u64)lines * hts * 1000, state->pclk_khz);
+	meta->gain = gain & 0x3ff;
+	meta->frame_us = div_u64((u64)vts * hts * 1000, state->pclk_khz);
+	meta->timestamp_ns = now;
+	spin_unlock(&state->zsl_lock);
 }
-/* called by HAL after auto focus was started to get the first search result*/
-static int ov5640_get_auto_focus_result_first(struct v4l2_subdev *sd,
-                                        struct v4l2_control *ctrl)
+
+/*
+ * ZSL keeps the sensor streaming full resolution frames, so a capture
+ * needs no mode switch and the host may keep any frame around the trigger.
+ */
+static int ov5640_set_zsl(struct v4l2_subdev *sd, int enable)
 {
-        struct i2c_client *client = v4l2_get_subdevdata(sd);
-        struct s5k4ba_state *state =
-                container_of(sd, struct s5k4ba_state, sd);
-        u16 read_value;
-        int ret = 0;
-	
-	int ret_val = as3643_flash_off();
-                printk("\n ov5640 ==> flash offf ==> ret_value = 0x%0x",ret_val);
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct s5k4ba_state *state = to_state(sd);
+	int err;
 
-        if (state->af_status == AF_INITIAL) {
-                dev_dbg(&client->dev, "%s: Check AF Result\n", __func__); 
-		printk("\n %s: Check AF Result\n", __func__);
-                if (state->af_status == AF_NONE) {
-                        dev_dbg(&client->dev,
-                                "%s: auto focus never started, returning 0x2\n",
-                                __func__);
-                        ctrl->value = AUTO_FOCUS_CANCELLED;
-                        return 0;
-                }
+	if (!!enable == state->zsl)
+		return 0;
 
-                state->af_status = AF_START;
-        } else if (state->af_status == AF_CANCEL) {
-                dev_dbg(&client->dev,
-                        "%s: AF is cancelled while doing\n", __func__) ;
-		printk("\n %s: AF is cancelled while doing \n", __func__);
-                ctrl->value = AUTO_FOCUS_CANCELLED;
-                return 0;
-        }
-//      (client, 0x0F12, &read_value);
+	if (!enable) {
+		state->zsl = false;
+		cancel_work_sync(&state->zsl_work);
+		return ov5640_restore_preview(sd);
+	}
 
-        u8 read_byte = 0;
+	if (state->runmode == S5K4BA_RUNMODE_NOTREADY || state->bracket)
+		return -EBUSY;
 
-        ret = ov5640_reg_read(sd, 0x3023, &read_byte);
-        if (ret) {
-                printk("Failed to read auto focus result 0x3023.\n");
+	state->capture_armed = false;
+	err = ov540_block_writes(sd, regset_zsl, ARRAY_SIZE(regset_zsl));
+	if (err) {
+		dev_err(&client->dev, "%s: ZSL register set failed\n",
+			__func__);
+		return err;
+	}
+	state->pclk_khz = ov5640_pclk_khz(state, OV5640_ZSL_PCLK_KHZ);
+	state->active.mode = NULL;
+	ov5640_set_runmode(state, S5K4BA_RUNMODE_CAPTURE);
 
-        }else{
-		printk("%s: 1st i2c_read 0x3023 --- read_value == 0x%x\n",
-                                __func__, read_byte);
-                if(read_byte == 0x01){
-                        ctrl->value = read_byte;
-                        return 0; //Robin Need to check it .
-                }
-        }
+	spin_lock(&state->zsl_lock);
+	state->zsl_count = 0;
+	spin_unlock(&state->zsl_lock);
 
-        ret = ov5640_reg_read(sd, 0x3028, &read_byte);
-        if (ret) {
-                printk("Failed to read auto focus result 0x3028.\n");
-
-        }else{
-		printk("%s: 1st i2c_read ---0x3028  read_value == 0x%x\n",
-                                        __func__, read_byte);
-                if(read_byte){
-                        ctrl->value = read_byte;
-                        return 0;
-                }else{
-                        ctrl->value = 0;
-                        return 0;
-                }
-        }
-        printk("%s: 1st i2c_read --- outer loop read_value == 0x%x\n", __func__, read_byte);
+	/* sampled from the next frame end on, see ov5640_frame_end() */
+	state->zsl = true;
+	return 0;
+}
 
-        return 0;
+/* VIDIOC_OV5640_G_ZSL_META: copy out the ring, oldest sample first */
+static long ov5640_get_zsl_meta(struct v4l2_subdev *sd,
+				struct ov5640_zsl_meta *out)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	u32 i, n;
 
-}
+	memset(out, 0, sizeof(*out));
 
+	spin_lock(&state->zsl_lock);
+	n = min_t(u32, state->zsl_count, OV5640_ZSL_META_DEPTH);
+	for (i = 0; i < n; i++)
+		out->frames[i] = state->zsl_meta[(state->zsl_count - n + i) %
+						OV5640_ZSL_META_DEPTH];
+	out->count = n;
+	spin_unlock(&state->zsl_lock);
 
+	return state->zsl ? 0 : -ENODATA;
+}
 
-static int s5k4ba_enum_frameintervals(struct v4l2_subdev *sd,
-					struct v4l2_frmivalenum *fival)
+static const u16 ov5640_bracket_regs[OV5640_BRACKET_REGS] = {
+	0x3500, 0x3501, 0x3502,		/* exposure, 1/16 lines */
+	0x350A, 0x350B,			/* gain */
+	0x380E, 0x380F,			/* VTS */
+};
+
+/* put back what the sensor ran with before the sequence, group_lock held */
+static void ov5640_bracket_restore(struct v4l2_subdev *sd)
 {
-	int err = 0;
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct s5k4ba_state *state = to_state(sd);
+	unsigned long flags;
+	int j, err = 0;
+
+	for (j = 0; !err && j < OV5640_BRACKET_REGS; j++)
+		err = ov5640_reg_write(sd, ov5640_bracket_regs[j],
+					state->bracket_saved[j]);
+	if (!err)
+		err = ov5640_reg_write(sd, 0x3503, state->bracket_aec);
+	if (err)
+		dev_err(&client->dev, "%s: exposure restore failed\n",
+			__func__);
 
-	return err;
+	spin_lock_irqsave(&state->bracket_lock, flags);
+	state->bracket = false;
+	spin_unlock_irqrestore(&state->bracket_lock, flags);
 }
 
-static int ov5640_g_parm(struct v4l2_subdev *sd, struct v4l2_streamparm *param)
+/* end a sequence early, e.g. on stream off */
+static void ov5640_bracket_stop(struct v4l2_subdev *sd)
 {
-	struct i2c_client *client = v4l2_get_subdevdata(sd);
-	int err = 0;
+	struct s5k4ba_state *state = to_state(sd);
+	unsigned long flags;
+	bool running;
+
+	spin_lock_irqsave(&state->bracket_lock, flags);
+	running = state->bracket;
+	state->bracket = false;
+	spin_unlock_irqrestore(&state->bracket_lock, flags);
+
+	cancel_work_sync(&state->bracket_work);
+	if (running) {
+		mutex_lock(&state->group_lock);
+		ov5640_bracket_restore(sd);
+		mutex_unlock(&state->group_lock);
+	}
+}
 
-	dev_dbg(&client->dev, "%s\n", __func__);
+/*
+ * OV5640_FRAME_END from the host's frame end interrupt: note the frame,
+ * let the bracketing work launch the next group and sample ZSL exposure
+ */
+static long ov5640_frame_end(struct v4l2_subdev *sd, const u32 *sequence)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	unsigned long flags;
+
+	spin_lock_irqsave(&state->bracket_lock, flags);
+	state->frame_events = true;
+	state->frame_seq = *sequence;
+	if (state->bracket)
+		queue_work(state->wq, &state->bracket_work);
+	spin_unlock_irqrestore(&state->bracket_lock, flags);
+	if (state->zsl)
+		queue_work(state->wq, &state->zsl_work);
+	return 0;
+}
 
-	return err;
+/*
+ * Launch the next preloaded group after a frame end, one group per frame.
+ * The frame exposed with it is OV5640_BRACKET_DELAY frames on; if the work
+ * runs late and misses a frame end, the metadata still names the right
+ * frame. The frame end after the last launch puts the old settings back.
+ */
+static void ov5640_bracket_work(struct work_struct *work)
+{
+	struct s5k4ba_state *state =
+		container_of(work, struct s5k4ba_state, bracket_work);
+	struct v4l2_subdev *sd = &state->sd;
+	struct ov5640_bracket_frame *meta;
+	u32 g, seq, lines, vts;
+	unsigned long flags;
+	bool running;
+	const u8 *v;
+	int j;
+
+	spin_lock_irqsave(&state->bracket_lock, flags);
+	running = state->bracket;
+	seq = state->frame_seq;
+	g = state->bracket_next;
+	spin_unlock_irqrestore(&state->bracket_lock, flags);
+	if (!running)
+		return;
+
+	mutex_lock(&state->group_lock);
+	if (g == state->bracket_shots ||
+			ov5640_reg_write(sd, OV5640_REG_GROUP_ACCESS,
+					OV5640_GROUP_LAUNCH(g))) {
+		ov5640_bracket_restore(sd);
+		goto out;
+	}
+
+	v = state->bracket_vals[g];
+	for (j = 0; j < OV5640_BRACKET_REGS; j++)
+		ov5640_shadow_set(state, ov5640_bracket_regs[j], v[j]);
+	lines = ((v[0] << 16) | (v[1] << 8) | v[2]) >> 4;
+	vts = (v[5] << 8) | v[6];
+
+	spin_lock_irqsave(&state->bracket_lock, flags);
+	meta = &state->bracket_meta[g];
+	meta->sequence = seq + OV5640_BRACKET_DELAY;
+	meta->shot = g;
+	meta->exposure_us = div_u64((u64)lines * state->bracket_hts * 1000,
+			state->pclk_khz);
+	meta->gain = ((v[3] << 8) | v[4]) & 0x3ff;
+	meta->frame_us = div_u64((u64)vts * state->bracket_hts * 1000,
+			state->pclk_khz);
+	state->bracket_next = g + 1;
+	spin_unlock_irqrestore(&state->bracket_lock, flags);
+out:
+	mutex_unlock(&state->group_lock);
 }
 
-static int ov5640_set_flash_mode(struct v4l2_subdev *sd, int value)
+/*
+ * VIDIOC_OV5640_S_BRACKET: preload @br into group holds 0..count-1; the
+ * next frame ends launch them. Group 0 is shared with the capture
+ * pre-staging, which has to be armed again afterwards.
+ */
+static long ov5640_set_bracket(struct v4l2_subdev *sd,
+				const struct ov5640_bracket *br)
 {
-        struct s5k4ba_state *state =
-                container_of(sd, struct s5k4ba_state, sd);
-        struct sec_cam_parm *parms =
-                (struct sec_cam_parm *)&state->strm.parm.raw_data;
-	/*
-        if (parms->flash_mode == value)
-                return 0;
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct s5k4ba_state *state = to_state(sd);
+	u32 i, hts, vts, lines, gain, frame;
+	unsigned long flags;
+	u8 timing[4], *v;
+	int j, err;
 
-        if ((value >= FLASH_MODE_OFF) && (value <= FLASH_MODE_TORCH)) {
-                pr_debug("%s: setting flash mode to %d\n",
-                        __func__, value);
-                parms->flash_mode = value;
-                if (parms->flash_mode == FLASH_MODE_TORCH)
-                        s5k4ecgx_enable_torch(sd);
-                else
-                        s5k4ecgx_disable_torch(sd);
-                return 0;
-        }
+	if (!br->count || br->count > OV5640_BRACKET_MAX)
+		return -EINVAL;
+	/* without frame ends there is nothing to pace the launches */
+	if (!state->frame_events)
+		return -EOPNOTSUPP;
 
-        */
+	mutex_lock(&state->ctrl_lock);
+	if (state->bracket || !state->pclk_khz ||
+			(state->runmode != S5K4BA_RUNMODE_RUNNING &&
+			state->runmode != S5K4BA_RUNMODE_CAPTURE)) {
+		err = -EBUSY;
+		goto out;
+	}
 
-        printk("\n AS3643 Torch ON or OFF = %d",value);
+	err = ov5640_reg_read_multi(sd, 0x380C, timing, sizeof(timing));
+	if (!err)
+		err = ov5640_reg_read_batch(sd, ov5640_bracket_regs,
+				state->bracket_saved, OV5640_BRACKET_REGS);
+	if (!err)
+		err = ov5640_reg_read(sd, 0x3503, &state->bracket_aec);
+	if (err)
+		goto out;
 
-        if ((value >= FLASH_MODE_OFF) && (value <= FLASH_MODE_TORCH)) {
-                printk("%s: setting flash mode to %d\n",
-                        __func__, value);
-                if (value == FLASH_MODE_TORCH) {
-			printk("\n parms->flash_mode = %d , Test: =FLASH_MODE_OFF =%d",parms->flash_mode,FLASH_MODE_OFF); 
-			if (parms->flash_mode !=FLASH_MODE_OFF)
-                        	as3643_torch_mode_on();
-                } else {
-                        as3643_torch_off();
-		}
-                return 0;
-        }
+	hts = ((timing[0] & 0x1f) << 8) | timing[1];
+	vts = (timing[2] << 8) | timing[3];
+	if (!hts) {
+		err = -EIO;
+		goto out;
+	}
 
+	/* a long exposure stretches its own frame */
+	for (i = 0; i < br->count; i++) {
+		lines = div_u64((u64)br->shots[i].exposure_us * state->pclk_khz,
+				hts * 1000);
+		lines = clamp_t(u32, lines, 1, 0xfff0);
+		gain = clamp_t(u32, br->shots[i].gain, 16, 0x3ff);
+		frame = max(vts, lines + 4);
+
+		v = state->bracket_vals[i];
+		v[0] = lines >> 12;
+		v[1] = lines >> 4;
+		v[2] = lines << 4;
+		v[3] = gain >> 8;
+		v[4] = gain;
+		v[5] = frame >> 8;
+		v[6] = frame;
+	}
 
-        printk("%s: trying to set invalid flash mode %d\n",
-                __func__, value);
-        return -EINVAL;
+	/* AEC/AGC must not move the exposure under the groups */
+	err = ov5640_reg_write(sd, 0x3503, 0x03);
+	if (err)
+		goto out;
+
+	mutex_lock(&state->group_lock);
+	state->capture_armed = false;
+	state->shadow_hold = true;
+	for (i = 0; !err && i < br->count; i++) {
+		err = ov5640_reg_write(sd, OV5640_REG_GROUP_ACCESS,
+					OV5640_GROUP_HOLD_START(i));
+		for (j = 0; !err && j < OV5640_BRACKET_REGS; j++)
+			err = ov5640_reg_write(sd, ov5640_bracket_regs[j],
+					state->bracket_vals[i][j]);
+		if (!err)
+			err = ov5640_reg_write(sd, OV5640_REG_GROUP_ACCESS,
+					OV5640_GROUP_HOLD_END(i));
+	}
+	state->shadow_hold = false;
+	mutex_unlock(&state->group_lock);
+	if (err) {
+		dev_err(&client->dev, "%s: group hold staging failed\n",
+			__func__);
+		ov5640_reg_write(sd, 0x3503, state->bracket_aec);
+		goto out;
+	}
+
+	spin_lock_irqsave(&state->bracket_lock, flags);
+	state->bracket_shots = br->count;
+	state->bracket_next = 0;
+	state->bracket_hts = hts;
+	state->bracket = true;
+	spin_unlock_irqrestore(&state->bracket_lock, flags);
+out:
+	mutex_unlock(&state->ctrl_lock);
+	return err;
 }
 
-static int ov5640_s_parm(struct v4l2_subdev *sd, struct v4l2_streamparm *param)
+/* VIDIOC_OV5640_G_BRACKET_META: the frames of the last sequence so far */
+static long ov5640_get_bracket_meta(struct v4l2_subdev *sd,
+				struct ov5640_bracket_meta *out)
 {
-	struct i2c_client *client = v4l2_get_subdevdata(sd);
-	int err = 0;
-
-	struct s5k4ba_state *state =
-                container_of(sd, struct s5k4ba_state, sd);
-        struct sec_cam_parm *new_parms =
-                (struct sec_cam_parm *)&param->parm.raw_data;
-        struct sec_cam_parm *parms =
-                (struct sec_cam_parm *)&state->strm.parm.raw_data;
+	struct s5k4ba_state *state = to_state(sd);
+	unsigned long flags;
+	u32 i;
 
-	dev_dbg(&client->dev, "%s: numerator %d, denominator: %d\n", \
-		__func__, param->parm.capture.timeperframe.numerator, \
-		param->parm.capture.timeperframe.denominator); 
-	
-	err = ov5640_set_flash_mode(sd, new_parms->flash_mode);
-	/* Must delay 150ms before setting macro mode due to a camera
-         * sensor requirement */
-        if ((new_parms->focus_mode == FOCUS_MODE_MACRO) &&
-                        (parms->focus_mode != FOCUS_MODE_MACRO))
-                msleep(150);
-        //err |= ov5640_set_focus_mode(sd, new_parms->focus_mode);
+	memset(out, 0, sizeof(*out));
 
-	
+	spin_lock_irqsave(&state->bracket_lock, flags);
+	out->count = state->bracket_next;
+	out->shots = state->bracket_shots;
+	for (i = 0; i < out->count; i++)
+		out->frames[i] = state->bracket_meta[i];
+	spin_unlock_irqrestore(&state->bracket_lock, flags);
 
-	return err;
+	return out->shots ? 0 : -ENODATA;
 }
 
-static int ov5640_g_ctrl(struct v4l2_subdev *sd, struct v4l2_control *ctrl)
+/*
+ * V4L2_CID_OV5640_CAPTURE_ARM, sent by the host on half-press: prepare the
+ * capture mode while preview runs. The entries of
+ * regset_capture_resoxxxx that would not change anything are dropped, the
+ * group-able rest is latched in group hold 0, and ov5640_start_capture()
+ * is left with the few system control registers and one launch write.
+ * A capture delta too large for the group stays unarmed and goes out the
+ * usual way at capture time.
+ */
+static int ov5640_arm_capture(struct v4l2_subdev *sd)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(sd);
 	struct s5k4ba_state *state = to_state(sd);
-	struct s5k4ba_userset userset = state->userset;
-	int err = -EINVAL; 
-	
-        struct sec_cam_parm *parms =
-                (struct sec_cam_parm *)&state->strm.parm.raw_data;
+	struct ov5640_capture_stage *stage = state->capture;
+	const struct ov5640_reg *r;
+	struct ov5640_reg *list;
+	int *num;
+	int i, err, room, elided = 0;
+	u8 cur, addr[2];
+
+	if (state->capture_armed)
+		return 0;
+	/* group 0 may hold a bracketing shot */
+	if (state->bracket ||
+			(state->runmode != S5K4BA_RUNMODE_IDLE &&
+			state->runmode != S5K4BA_RUNMODE_RUNNING))
+		return -EBUSY;
+
+	stage->num_direct = stage->num_group = 0;
+	for (i = 0; i < ARRAY_SIZE(regset_capture_resoxxxx); i++) {
+		r = &regset_capture_resoxxxx[i];
+		if ((r->reg >> 8) == 0x30) {
+			list = stage->direct;
+			num = &stage->num_direct;
+		} else {
+			list = stage->group;
+			num = &stage->num_group;
+		}
 
-	mutex_lock(&state->ctrl_lock);
-	switch (ctrl->id) { 
-	case V4L2_CID_CAMERA_WHITE_BALANCE:
-                ctrl->value = parms->white_balance;
-                break;
-        case V4L2_CID_CAMERA_EFFECT:
-                ctrl->value = parms->effects;
-                break;
-        case V4L2_CID_CAMERA_CONTRAST:
-                ctrl->value = parms->contrast;
-                break;
-        case V4L2_CID_CAMERA_SATURATION:
-                ctrl->value = parms->saturation;
-                break;
-        case V4L2_CID_CAMERA_SHARPNESS:
-                ctrl->value = parms->sharpness;
-                break;
-	case V4L2_CID_EXPOSURE:
-		ctrl->value = userset.exposure_bias;
-		err = 0;
-		break;
-	case V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_FIRST:
-                err = ov5640_get_auto_focus_result_first(sd, ctrl);
-                break;
-	 case V4L2_CID_CAM_DATE_INFO_YEAR:
-                ctrl->value = 2013;
-                break;
-        case V4L2_CID_CAM_DATE_INFO_MONTH:
-                ctrl->value = 1;
-                break;
-        case V4L2_CID_CAM_DATE_INFO_DATE:
-                ctrl->value = 1;
-                break;
-	case V4L2_CID_CAMERA_EXIF_ISO:
-		/* TODO Need to implement  Robin Singh*/
-                //err = s5k4ecgx_get_iso(sd, ctrl);
-		ctrl->value = ISO_50;
-                break;
-        case V4L2_CID_CAMERA_EXIF_EXPTIME:
-		/* TODO : Robin */
-                //err = s5k4ecgx_get_shutterspeed(sd, ctrl);
-                break;
-        case V4L2_CID_CAMERA_EXIF_FLASH:
-                ctrl->value = state->flash_state_on_previous_capture;
-                break;
-        case V4L2_CID_CAMERA_OBJ_TRACKING_STATUS:
-        case V4L2_CID_CAMERA_SMART_AUTO_STATUS:
-                break;
-	default:
-		dev_err(&client->dev, "%s: no such ctrl\n", __func__);
-		break;
+		if (ov5640_stage_value(state, list, *num, r->reg, &cur) &&
+				cur == r->val) {
+			elided++;
+			continue;
+		}
+		list[(*num)++] = *r;
 	}
 
-	mutex_unlock(&state->ctrl_lock);
+	err = ov5640_reg_read_multi(sd, OV5640_REG_GROUP_ADDR, addr, 2);
+	if (err)
+		return err;
+	room = addr[1] > addr[0] ? (addr[1] - addr[0]) *
+		OV5640_GROUP_ADDR_UNIT / OV5640_GROUP_ENTRY_BYTES : 0;
+	if (stage->num_group > room) {
+		ov5640_dbg(sd, OV5640_DBG_MODE,
+			"%s: %d registers do not fit group 0 (%d)\n",
+			__func__, stage->num_group, room);
+		return 0;
+	}
+
+	mutex_lock(&state->group_lock);
+	state->shadow_hold = true;
+	err = ov5640_reg_write(sd, OV5640_REG_GROUP_ACCESS,
+				OV5640_GROUP_HOLD_START(0));
+	for (i = 0; !err && i < stage->num_group; i++)
+		err = ov5640_reg_write(sd, stage->group[i].reg,
+					stage->group[i].val);
+	if (!err)
+		err = ov5640_reg_write(sd, OV5640_REG_GROUP_ACCESS,
+					OV5640_GROUP_HOLD_END(0));
+	state->shadow_hold = false;
+	mutex_unlock(&state->group_lock);
+	if (err) {
+		dev_err(&client->dev, "%s: group hold staging failed\n",
+			__func__);
+		return err;
+	}
+
+	state->capture_armed = true;
+	atomic_add(elided, &state->stats.elided);
+	ov5640_dbg(sd, OV5640_DBG_MODE, "%s: %d direct, %d grouped, %d elided\n",
+		__func__, stage->num_direct, stage->num_group, elided);
+	return 0;
+}
+
+/* switch to the capture mode staged by ov5640_arm_capture() */
+static int ov5640_launch_capture(struct v4l2_subdev *sd)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	struct ov5640_capture_stage *stage = state->capture;
+	int i, err = 0;
+
+	state->capture_armed = false;
+
+	for (i = 0; !err && i < stage->num_direct; i++)
+		err = ov5640_reg_write(sd, stage->direct[i].reg,
+					stage->direct[i].val);
+	if (err)
+		return err;
+
+	mutex_lock(&state->group_lock);
+	err = ov5640_reg_write(sd, OV5640_REG_GROUP_ACCESS,
+				OV5640_GROUP_LAUNCH(0));
+	for (i = 0; !err && i < stage->num_group; i++)
+		ov5640_shadow_set(state, stage->group[i].reg,
+				stage->group[i].val);
+	mutex_unlock(&state->group_lock);
 	return err;
 }
 
@@ -1707,11 +4269,28 @@ static int ov5640_set_capture_size(struct v4l2_subdev *sd)
         state->runmode = S5K4ECGX_RUNMODE_CAPTURE;
 	*/
 
-	printk("\n ov5640_set_capture_size : sensor setting for cap size");
-	err = ov5640_reg_writes(sd, regset_capture_resoxxxx,
-                        ARRAY_SIZE(regset_capture_resoxxxx));
+	state->pending.mode = OV5640_MODE_CAPTURE;
+	if (state->capture_armed) {
+		ov5640_dbg(sd, OV5640_DBG_MODE, "%s: launching staged capture\n",
+			__func__);
+		err = ov5640_launch_capture(sd);
+		if (!err) {
+			state->active.mode = OV5640_MODE_CAPTURE;
+			state->active.fps = 0;
+			state->pclk_khz = ov5640_pclk_khz(state,
+						OV5640_CAPTURE_PCLK_KHZ);
+			ov5640_set_runmode(state, S5K4BA_RUNMODE_CAPTURE);
+		}
+	}
+	/* the unarmed case, or a frame rate left to adjust */
+	if (!err) {
+		ov5640_dbg(sd, OV5640_DBG_MODE,
+			"%s: sensor setting for cap size\n", __func__);
+		err = ov5640_flush_config(sd);
+	}
         if (err){
-                printk(" OV5640 i2cregister write for Capture : resolution =  .... failed ");
+                dev_err(&client->dev, "%s: capture register set failed\n",
+                        __func__);
         }
 
 	
@@ -1729,9 +4308,16 @@ static int ov5640_start_capture(struct v4l2_subdev *sd)
         struct s5k4ba_state *state =
                 container_of(sd, struct s5k4ba_state, sd);
         struct ov5640_platform_data *pdata = client->dev.platform_data;
+	ktime_t start = ktime_get();
 
 	mycapture = 1;
 
+	/* the sensor already streams full resolution frames */
+	if (state->zsl) {
+		ov5640_stats_latency(state, OV5640_LAT_CAPTURE, start);
+		return 0;
+	}
+
 	err = ov5640_set_capture_size(sd);
         if (err < 0) {
                 dev_err(&client->dev,
@@ -1739,14 +4325,14 @@ static int ov5640_start_capture(struct v4l2_subdev *sd)
                         __func__);
                 return -EIO;
         }
-        dev_info(&client->dev, "%s: send Capture_Start cmd\n", __func__);
+        ov5640_dbg(sd, OV5640_DBG_MODE, "%s: send Capture_Start cmd\n", __func__);
         //s5k4ecgx_set_from_table(sd, "capture start",
           //                      &state->regs->capture_start, 1, 0);
 
         /* restore Preview  mode */
 
 
-	
+	ov5640_stats_latency(state, OV5640_LAT_CAPTURE, start);
 	return 0;
 
 } 
@@ -1762,7 +4348,7 @@ static int  OV5640_CAMERA_Module_AF_Init(struct v4l2_subdev *sd){
 	if(err){
 		printk("\n Error in fimware start download start cmd.{0x3000,0x20 }");
 	} 
-	mdelay(1);
+	ov5640_mdelay(1);
  	ov5640_reg_read(sd, 0x3000, &value);
         printk(" Frimware download start(%x ,  %x)\n",0x3000, value );
 
@@ -1774,7 +4360,7 @@ static int  OV5640_CAMERA_Module_AF_Init(struct v4l2_subdev *sd){
                         return err; 
                // ov5640_reg_read(sd, firmwareaddr, &value);
                 //printk(" Frimware download (%x ,  %x)\n",firmwareaddr, value );
-		mdelay(1);
+		ov5640_mdelay(1);
 		firmwareaddr++;
         } 
 	
@@ -1788,13 +4374,55 @@ static int  OV5640_CAMERA_Module_AF_Init(struct v4l2_subdev *sd){
 
 }
 
+/* EV table for a V4L2_CID_CAMERA_BRIGHTNESS value, as the switch below */
+static const struct ov5640_reg *ov5640_ev_table(int val)
+{
+	switch (val) {
+	case 5:
+		return OV5640_EV_P2;
+	case 4:
+		return OV5640_EV_P1;
+	case 2:
+		return OV5640_EV_M1;
+	case 1:
+		return OV5640_EV_M2;
+	default:
+		return OV5640_EV_0;
+	}
+}
+
+/* true if the shadow holds every value of @list */
+static bool ov5640_regs_applied(struct s5k4ba_state *state,
+				const struct ov5640_reg *list, int num)
+{
+	u8 cur;
+
+	while (--num >= 0)
+		if (!ov5640_shadow_get(state, list[num].reg, &cur) ||
+				cur != list[num].val)
+			return false;
+	return true;
+}
+
 static int ov5640_set_brightness(struct v4l2_subdev *sd,
         struct v4l2_control *ctrl)
 {
+        struct i2c_client *client = v4l2_get_subdevdata(sd);
+        struct s5k4ba_state *state = to_state(sd);
         struct v4l2_queryctrl qc = {0,};
         int val = ctrl->value, err;
         u32 exposure[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
-        printk("E, value %d\n", val);
+        ov5640_dbg(sd, OV5640_DBG_CTRL, "%s: value %d\n", __func__, val);
+
+        if (state->bracket)
+                return -EBUSY;
+
+        /* every EV table programs the same six AEC target registers */
+        if (ov5640_regs_applied(state, ov5640_ev_table(val),
+                        ARRAY_SIZE(OV5640_EV_0))) {
+                atomic_add(ARRAY_SIZE(OV5640_EV_0), &state->stats.elided);
+                return 0;
+        }
 
         switch (val)
         {
@@ -1803,7 +4431,7 @@ static int ov5640_set_brightness(struct v4l2_subdev *sd,
         	      ARRAY_SIZE(OV5640_EV_P2));
 
 	        if (err){
-                	printk(" OV5640 brightness OV5640_EV_P2  setting failed ");
+                	dev_err(&client->dev, "%s: OV5640_EV_P2 setting failed\n", __func__);
         	}
                 break;
         case (4):
@@ -1811,7 +4439,7 @@ static int ov5640_set_brightness(struct v4l2_subdev *sd,
                       ARRAY_SIZE(OV5640_EV_P1));
 
                 if (err){
-                        printk(" OV5640 brightness OV5640_EV_P1  setting failed ");
+                        dev_err(&client->dev, "%s: OV5640_EV_P1 setting failed\n", __func__);
                 }
 
                 break;
@@ -1821,7 +4449,7 @@ static int ov5640_set_brightness(struct v4l2_subdev *sd,
                       ARRAY_SIZE(OV5640_EV_0));
 
                 if (err){
-                        printk(" OV5640 brightness OV5640_EV_0  setting failed ");
+                        dev_err(&client->dev, "%s: OV5640_EV_0 setting failed\n", __func__);
                 }
 
                 break;
@@ -1831,7 +4459,7 @@ static int ov5640_set_brightness(struct v4l2_subdev *sd,
                       ARRAY_SIZE(OV5640_EV_M1));
 
                 if (err){
-                        printk(" OV5640 brightness OV5640_EV_M1  setting failed ");
+                        dev_err(&client->dev, "%s: OV5640_EV_M1 setting failed\n", __func__);
                 }
 
                 break;
@@ -1841,7 +4469,7 @@ static int ov5640_set_brightness(struct v4l2_subdev *sd,
                       ARRAY_SIZE(OV5640_EV_M2));
 
                 if (err){
-                        printk(" OV5640 brightness OV5640_EV_M2  setting failed ");
+                        dev_err(&client->dev, "%s: OV5640_EV_M2 setting failed\n", __func__);
                 }
 
                 break;
@@ -1851,7 +4479,7 @@ static int ov5640_set_brightness(struct v4l2_subdev *sd,
                       ARRAY_SIZE(OV5640_EV_0));
 
                 if (err){
-                        printk(" OV5640 brightness OV5640_EV_0  setting failed ");
+                        dev_err(&client->dev, "%s: OV5640_EV_0 setting failed\n", __func__);
                 }
 
                 break;
@@ -1871,7 +4499,12 @@ static int ov5640_finish_auto_focus(struct v4l2_subdev *sd)
                 container_of(sd, struct s5k4ba_state, sd);
 
 
-        state->af_status = AF_NONE;
+        if (state->flash_on) {
+                as3643_flash_off();
+                state->flash_on = false;
+        }
+        ov5640_af_cache_invalidate(state);
+        ov5640_set_af_status(state, AF_NONE);
         return 0;
 }
 
@@ -1886,41 +4519,42 @@ static int ov5640_stop_auto_focus(struct v4l2_subdev *sd)
 	return 0;
 }
 
+/*
+ * Hand a command to the AF MCU. With @wait the MCU must take it within
+ * OV5640_AF_CMD_TIMEOUT_MS, otherwise the result is left to the status
+ * cache.
+ */
+static int ov5640_af_cmd(struct v4l2_subdev *sd, u8 cmd, bool wait)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	const struct ov5640_seq seq[] = {
+		OV5640_SEQ_W(0x3023, 0x01),
+		OV5640_SEQ_W(0x3022, cmd),
+		OV5640_SEQ_POLL(0x3023, 0xff, 0x00, OV5640_AF_CMD_TIMEOUT_MS),
+	};
+	int err;
+
+	err = ov5640_run_seq(sd, seq, wait ? ARRAY_SIZE(seq) : 2);
+	ov5640_af_cache_invalidate(state);
+	ov5640_set_af_cached(state, false);
+
+	if (err == -ETIMEDOUT)
+		ov5640_dbg(sd, OV5640_DBG_AF, "%s: command 0x%02x not taken\n",
+			__func__, cmd);
+	return err;
+}
+
 static int OV5640_CAMERA_Module_AF_STOP( struct v4l2_subdev *sd){
-	u8 read_byte = 0;
-	int err = 0, i;
         // Release Focus 
-        err = ov5640_reg_write(sd, 0x3023,0x01);
-                if (err)
-                        return err;
-        err = ov5640_reg_write(sd, 0x3022,0x08);
-                if (err)
-                        return err;
-
-	  for(i = 0; i < 200; i++){
-
-		 err = ov5640_reg_read(sd, 0x3023, &read_byte);
-                if (err) {
-                        printk("Failed to read auto focus result 0x3023.\n");
-                        return err;
-                }
-                printk("%s: read 0x3023 --- read_value == 0x%x\n",
-                                __func__, read_byte);
-                if(read_byte == 0x00)
-                        break;
-
-		mdelay(10000);
-
-	  }
-	return 0;
+	return ov5640_af_cmd(sd, OV5640_AF_CMD_RELEASE, true);
 }
 static int ov5640_auto_focus_enable( struct v4l2_subdev *sd,int mode){
 
-	  printk("+AF START\r\n");
+	  ov5640_dbg(sd, OV5640_DBG_AF, "+AF START\n");
 
       if(OV5640_CAMERA_Module_AF_STOP(sd)){
 
-	  	 printk("OV5640_CAMERA_Module_AF_STOP error\r\n");
+	  	 ov5640_dbg(sd, OV5640_DBG_AF, "OV5640_CAMERA_Module_AF_STOP error\n");
 
          return 0;
 
@@ -1940,78 +4574,34 @@ static int ov5640_auto_focus_enable( struct v4l2_subdev *sd,int mode){
 }
 static int ov5640_enable_auto_focus(struct v4l2_subdev *sd,int mode)
 {
-	struct s5k4ba_state *state =
-                container_of(sd, struct s5k4ba_state, sd);
-        struct sec_cam_parm *parms =
-                (struct sec_cam_parm *)&state->strm.parm.raw_data;
-
-
-        u8   uBuf = 0; 
-	int err = 0, i; 
-	u8 read_byte = 0;
-	u8 value = 0;
-        // Release Focus 
-	err = ov5640_reg_write(sd, 0x3023,0x01);
-                if (err)
-                        return err; 
-	mdelay(1);
-        ov5640_reg_read(sd, 0x3023, &value);
-        printk(" Enable Auto focus(%x ,  %x)\n",0x3023, value );
-	
-
-	err = ov5640_reg_write(sd, 0x3022,0x08);
-                if (err)
-                        return err;
+	struct s5k4ba_state *state =
+                container_of(sd, struct s5k4ba_state, sd);
+	int err = 0;
 
-	mdelay(1);
-        ov5640_reg_read(sd, 0x3022, &value);
-        printk(" Enable Auto focus(%x ,  %x)\n",0x3022, value );
+	err = ov5640_wait_af_ready(sd);
+	if (err)
+		return err;
 
-        for (i = 0; i < 200; i++)
-        {
-               msleep(10); 
- 	       err = ov5640_reg_read(sd, 0x3023, &read_byte);
-        	if (err) {
-                	printk("Failed to read auto focus result 0x3023.\n");
-			return err;			
-        	}
-                printk("%s: read 0x3023 --- read_value == 0x%x\n",
-      	        	        __func__, read_byte);
-                if(read_byte == 0x00)
-                        break;	
-        }
+        // Release Focus; the MCU has to take it before the next command
+	err = ov5640_af_cmd(sd, OV5640_AF_CMD_RELEASE, true);
+	if (err)
+		return err;
         if (mode == 1)                // Single Auto Focus
         {
 		//int ret_val = as3643_assit_mode_on();
 
-		printk("\n  OLD value param->flash_state_on_previous_capture  = %d",state->flash_state_on_previous_capture);
                 if (state->flash_state_on_previous_capture !=FLASH_MODE_OFF) {
 			int ret_val = as3643_flash_on();
-                	printk("\n ov5640 ==> flash ==> ret_value = 0x%0x",ret_val);
+			ov5640_dbg(sd, OV5640_DBG_AF, "flash on, ret 0x%x\n", ret_val);
+			state->flash_on = true;
 		}
 		//int ret_val = as3643_flash_on();
-		//printk("\n ov5640 ==> flash ==> ret_value = 0x%0x",ret_val);
-                printk("OV5640_EnableAF::Single Auto Focus\r\n"); 
-		err = ov5640_reg_write(sd, 0x3023,0x01);
-                if (err) {
-                	printk("\n ov5640_enable_auto_focus write error 0x3023 : Single mode."); 
-		       return err;
-		}
-
-		mdelay(1);
-        	ov5640_reg_read(sd, 0x3023, &value);
-       		 printk(" Enable Single focus(%x ,  %x)\n",0x3023, value );
-
-
-
-       	        err = ov5640_reg_write(sd, 0x3022,0x03);
-                if (err) {
-			printk("\n ov5640_enable_auto_focus write error 0x3022: Single mode.");
+                ov5640_dbg(sd, OV5640_DBG_AF, "OV5640_EnableAF::Single Auto Focus\n");
+		/* 0x3023 clears when the search is over, the result polls it */
+		err = ov5640_af_cmd(sd, OV5640_AF_CMD_SINGLE, false);
+                if (err)
                         return err;
-		} 
-		mdelay(1);
-        	ov5640_reg_read(sd, 0x3022, &value);
-        	printk(" Enable single Auto focus(%x ,  %x)\n",0x3022, value ); 
+		state->af_start = ktime_get();
 
 		as3643_assit_mode_off();
 
@@ -2020,41 +4610,159 @@ static int ov5640_enable_auto_focus(struct v4l2_subdev *sd,int mode)
         }
         else if (mode == 2)           // Continue Auto Focus
         {
-                printk("OV5640_EnableAF::Continue Auto Focus\r\n");	
-		err = ov5640_reg_write(sd, 0x3023,0x01);
+                ov5640_dbg(sd, OV5640_DBG_AF, "OV5640_EnableAF::Continue Auto Focus\n");
+		/* the MCU keeps searching on its own, nothing to wait for */
+		err = ov5640_af_cmd(sd, OV5640_AF_CMD_CONTINUOUS, false);
                 if (err)
                         return err;
-        	err = ov5640_reg_write(sd, 0x3022,0x04);
-                if (err)
-                        return err;
-
-                for (i = 0; i < 200; i++)
-                {
-                        msleep(10);
-			err = ov5640_reg_read(sd, 0x3023, &read_byte);
-                	if (err) {
-                        	printk("Failed to read auto focus result 0x3023.\n");
-                        	return err;
-                	}
-                	printk("%s: Continue Auto Focus _read 0x3023 --- read_value == 0x%x\n",
-                                __func__, read_byte);
-                	if(read_byte == 0x00)
-                        	break;
-                }
+		state->af_continuous = true;
         } 
 	return 0;
 }
 
+/*
+ * FOCUS_MODE_CONTINUOUS* hands focus to the MCU without blocking; the
+ * other modes stop it and leave the lens to single AF requests.
+ */
+static int ov5640_set_focus_mode(struct v4l2_subdev *sd, int value)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	bool continuous;
+	int err;
+
+	continuous = value == FOCUS_MODE_CONTINUOUS ||
+		value == FOCUS_MODE_CONTINUOUS_PICTURE ||
+		value == FOCUS_MODE_CONTINUOUS_PICTURE_MACRO ||
+		value == FOCUS_MODE_CONTINUOUS_VIDEO;
+
+	if (continuous == state->af_continuous)
+		return 0;
+
+	err = ov5640_wait_af_ready(sd);
+	if (err)
+		return err;
+
+	err = ov5640_af_cmd(sd, continuous ? OV5640_AF_CMD_CONTINUOUS :
+				OV5640_AF_CMD_RELEASE, false);
+	if (err)
+		return err;
+
+	state->af_continuous = continuous;
+	return 0;
+}
+
+/*
+ * Touch AF: centre an AF zone on state->position (output pixels) and
+ * start a single search there. The zone centre goes to 0x3024/0x3025 and
+ * its size to 0x3026/0x3027, in AF grid units.
+ */
+static int ov5640_set_touch_af(struct v4l2_subdev *sd, int value)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	u32 width = state->pix.width ? : 640;
+	u32 height = state->pix.height ? : 480;
+	u8 zone[4];
+	/* the MCU has to take the zone before the search is started */
+	const struct ov5640_seq seq[] = {
+		OV5640_SEQ_BURST(0x3024, zone),
+		OV5640_SEQ_W(0x3023, 0x01),
+		OV5640_SEQ_W(0x3022, OV5640_AF_CMD_TOUCH_ZONE),
+		OV5640_SEQ_POLL(0x3023, 0xff, 0x00, OV5640_AF_CMD_TIMEOUT_MS),
+		OV5640_SEQ_W(0x3023, 0x01),
+		OV5640_SEQ_W(0x3022, OV5640_AF_CMD_SINGLE),
+	};
+	int err;
+
+	err = ov5640_wait_af_ready(sd);
+	if (err)
+		return err;
+
+	if (!value)
+		return ov5640_af_cmd(sd, OV5640_AF_CMD_DEFAULT_ZONE, true);
+
+	zone[0] = clamp_t(int, state->position.x * OV5640_AF_GRID_W / width,
+			0, OV5640_AF_GRID_W - 1);
+	zone[1] = clamp_t(int, state->position.y * OV5640_AF_GRID_H / height,
+			0, OV5640_AF_GRID_H - 1);
+	zone[2] = OV5640_AF_TOUCH_ZONE;
+	zone[3] = OV5640_AF_TOUCH_ZONE;
+
+	err = ov5640_run_seq(sd, seq, ARRAY_SIZE(seq));
+	ov5640_af_cache_invalidate(state);
+	ov5640_set_af_cached(state, false);
+	if (err)
+		return err;
+
+	ov5640_dbg(sd, OV5640_DBG_AF, "%s: zone at %u,%u\n", __func__,
+		zone[0], zone[1]);
+
+	state->af_continuous = false;
+	state->af_start = ktime_get();
+	return 0;
+}
+
+
+
+/*
+ * Manual focus: pause the AF MCU so it leaves the lens alone and drive
+ * the VCM DAC directly. 0x3602[3:0] hold the slew settings and are kept.
+ */
+static int ov5640_set_vcm_position(struct v4l2_subdev *sd, u16 dac)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	/* one burst; the AF MCU moves the DAC, so 0x3602 is read first */
+	const struct ov5640_seq seq[] = {
+		OV5640_SEQ_MASK(0x3602, 0xf0, (dac & 0x0f) << 4),
+		OV5640_SEQ_W(0x3603, (dac >> 4) & 0x3f),
+	};
+	int err;
+
+	err = ov5640_wait_af_ready(sd);
+	if (!err)
+		err = ov5640_af_cmd(sd, OV5640_AF_CMD_PAUSE, true);
+	if (err)
+		return err;
+	state->af_continuous = false;
+
+	return ov5640_run_seq(sd, seq, ARRAY_SIZE(seq));
+}
+
+static int ov5640_set_focus_absolute(struct v4l2_subdev *sd, int value)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	u16 dac = clamp_t(int, value, 0, 1023);
+	int err;
+
+	err = ov5640_set_vcm_position(sd, dac);
+	if (!err && state->focus_distance_mm)
+		ov5640_focus_store(state, state->focus_distance_mm, dac);
+	return err;
+}
 
 static int ov5640_stat_auto_focus_XXXXXXXXXXXXX(struct v4l2_subdev *sd){
 	int light_level;
         struct i2c_client *client = v4l2_get_subdevdata(sd);
         struct s5k4ba_state *state =
                 container_of(sd, struct s5k4ba_state, sd);
+	struct ov5640_focus_entry *e = NULL;
 	int err = 0;
-	err = ov5640_enable_auto_focus(sd,1);
+
+	/* known distance: move the lens there and skip the search */
+	if (state->focus_distance_mm)
+		e = ov5640_focus_lookup(state, state->focus_distance_mm);
+	if (e) {
+		err = ov5640_set_vcm_position(sd, e->dac);
+		if (!err) {
+			e->stamp = jiffies;
+			ov5640_set_af_cached(state, true);
+			ov5640_dbg(sd, OV5640_DBG_AF, "%s: %umm from cache\n",
+				__func__, e->distance_mm);
+		}
+	}
+	if (!e || err)
+		err = ov5640_enable_auto_focus(sd,1);
 	if(err)
-		printk(" ov5640_stat_auto_focus_XXXXXXXXXXXXX failed");
+		dev_err(&client->dev, "%s: failed\n", __func__);
 	
         return 0;
 
@@ -2067,7 +4775,6 @@ static int ov5640_start_auto_focus(struct v4l2_subdev *sd)
 
 static int ov5640_s_ctrl(struct v4l2_subdev *sd, struct v4l2_control *ctrl)
 { 
-	printk(" \n  s5k4ba_s_ctrl start ");
 #ifdef S5K4BA_COMPLETE
 	struct i2c_client *client = v4l2_get_subdevdata(sd);
 	int err = -EINVAL;
@@ -2078,16 +4785,71 @@ static int ov5640_s_ctrl(struct v4l2_subdev *sd, struct v4l2_control *ctrl)
                 (struct sec_cam_parm *)&state->strm.parm.raw_data;
 	
 	int value = ctrl->value;
+	ktime_t locked;
+	int i;
+
+	ov5640_dbg(sd, OV5640_DBG_CTRL, "%s: id 0x%x value %d\n", __func__,
+		ctrl->id, value);
 
+	/* the init worker holds ctrl_lock until the base config is out */
+	wait_for_completion(&state->base_done);
 	mutex_lock(&state->ctrl_lock);
+	locked = ktime_get();
 
 	switch (ctrl->id) { 
 
 	case V4L2_CID_CAMERA_CAPTURE:
                 err = ov5640_start_capture(sd);
                 break;
+	case V4L2_CID_OV5640_ZSL:
+		err = ov5640_set_zsl(sd, value);
+		break;
+	case V4L2_CID_OV5640_CAPTURE_ARM:
+		err = ov5640_arm_capture(sd);
+		break;
+	case V4L2_CID_CAMERA_FOCUS_MODE:
+		err = ov5640_set_focus_mode(sd, value);
+		if (!err)
+			parms->focus_mode = value;
+		break;
+	case V4L2_CID_CAMERA_OBJECT_POSITION_X:
+		state->position.x = value;
+		err = 0;
+		break;
+	case V4L2_CID_CAMERA_OBJECT_POSITION_Y:
+		state->position.y = value;
+		err = 0;
+		break;
+	case V4L2_CID_CAMERA_TOUCH_AF_START_STOP:
+		err = ov5640_set_touch_af(sd, value);
+		break;
+	case V4L2_CID_FOCUS_ABSOLUTE:
+		err = ov5640_set_focus_absolute(sd, value);
+		break;
+	case V4L2_CID_OV5640_FOCUS_DISTANCE:
+		state->focus_distance_mm = max(value, 0);
+		err = 0;
+		break;
+	case V4L2_CID_CAMERA_AE_LOCK_UNLOCK:
+		err = ov5640_set_ae_lock(sd, value == AE_LOCK);
+		break;
+	case V4L2_CID_CAMERA_AWB_LOCK_UNLOCK:
+		err = ov5640_set_awb_lock(sd, value == AWB_LOCK);
+		break;
+#ifdef V4L2_CID_3A_LOCK
+	case V4L2_CID_3A_LOCK:
+		err = ov5640_set_ae_lock(sd, value & V4L2_LOCK_EXPOSURE);
+		if (!err)
+			err = ov5640_set_awb_lock(sd,
+					value & V4L2_LOCK_WHITE_BALANCE);
+		break;
+#endif
 	case V4L2_CID_EXPOSURE:
 		dev_dbg(&client->dev, "%s: V4L2_CID_EXPOSURE\n", __func__);
+		if (state->bracket) {
+			err = -EBUSY;
+			break;
+		}
 		err = s5k4ba_write_regs(sd, \
 		(unsigned char *) s5k4ba_regs_ev_bias[ctrl->value], \
 			sizeof(s5k4ba_regs_ev_bias[ctrl->value]));
@@ -2096,17 +4858,56 @@ static int ov5640_s_ctrl(struct v4l2_subdev *sd, struct v4l2_control *ctrl)
 	case V4L2_CID_AUTO_WHITE_BALANCE:
 		dev_dbg(&client->dev, "%s: V4L2_CID_AUTO_WHITE_BALANCE\n", \
 			__func__);
-		err = s5k4ba_write_regs(sd, \
-		(unsigned char *) s5k4ba_regs_awb_enable[ctrl->value], \
-			sizeof(s5k4ba_regs_awb_enable[ctrl->value]));
+		err = ov5640_set_auto_wb(sd, ctrl->value);
 		break;
 
 	case V4L2_CID_WHITE_BALANCE_PRESET:
 		dev_dbg(&client->dev, "%s: V4L2_CID_WHITE_BALANCE_PRESET\n", \
 			__func__);
-		err = s5k4ba_write_regs(sd, \
-		(unsigned char *) s5k4ba_regs_wb_preset[ctrl->value], \
-			sizeof(s5k4ba_regs_wb_preset[ctrl->value]));
+		if (ctrl->value < 0 ||
+				ctrl->value >= ARRAY_SIZE(ov5640_wb_preset_kelvin))
+			break;
+		err = ov5640_set_wb_temperature(sd,
+				ov5640_wb_preset_kelvin[ctrl->value]);
+		if (!err)
+			state->userset.manual_wb = ctrl->value;
+		break;
+
+	case V4L2_CID_WHITE_BALANCE_TEMPERATURE:
+		/* 0 hands white balance back to the AWB */
+		err = ctrl->value ? ov5640_set_wb_temperature(sd, ctrl->value) :
+			ov5640_set_auto_wb(sd, true);
+		break;
+
+	case V4L2_CID_POWER_LINE_FREQUENCY:
+		if (ctrl->value < 0 || ctrl->value > OV5640_POWER_LINE_MAX)
+			break;
+		state->userset.banding = ctrl->value;
+		err = ov5640_apply_banding(sd);
+		break;
+
+	case V4L2_CID_OV5640_NIGHT_MIN_FPS:
+		if (ctrl->value < 0)
+			break;
+		state->userset.night_fps = ctrl->value;
+		err = ov5640_apply_night(sd);
+		break;
+
+	case V4L2_CID_CAMERA_ANTI_BANDING:
+		for (i = 0; i < ARRAY_SIZE(ov5640_anti_banding); i++)
+			if (ov5640_anti_banding[i] == ctrl->value)
+				break;
+		/* both controls share the setting, and so its range */
+		if (i > OV5640_POWER_LINE_MAX)
+			break;
+		state->userset.banding = i;
+		err = ov5640_apply_banding(sd);
+		break;
+
+	case V4L2_CID_CAMERA_WHITE_BALANCE:
+		err = ov5640_set_white_balance(sd, ctrl->value);
+		if (!err)
+			parms->white_balance = ctrl->value;
 		break;
 
 	case V4L2_CID_COLORFX:
@@ -2139,9 +4940,7 @@ static int ov5640_s_ctrl(struct v4l2_subdev *sd, struct v4l2_control *ctrl)
 	case V4L2_CID_CAMERA_FLASH_MODE: 
         	parms->flash_mode = value; 
 	
-		printk("\n [ V4L2_CID_CAMERA_FLASH_MODE: value = %d and ",value);	
 		state->flash_state_on_previous_capture = value; 
-		printk(" %s, <<<<< HAL setting Flash MODE value = %d ]",__func__,state->flash_state_on_previous_capture);
                 err = ov5640_set_flash_mode(sd, value);
                 break;
 
@@ -2174,6 +4973,8 @@ static int ov5640_s_ctrl(struct v4l2_subdev *sd, struct v4l2_control *ctrl)
 		break;
 	}
 
+	ov5640_ctrl_publish(state);
+	ov5640_stats_latency(state, OV5640_LAT_CTRL_LOCK, locked);
 	if (err < 0){
 		goto out;
 	
@@ -2189,21 +4990,49 @@ out:
 	return 0;
 #endif
 }
-static int ov5640_read_chip_id(struct v4l2_subdev *sd ){
-	
+/*
+ * Called from probe: fail fast with -ENODEV when no OV5640 answers, and
+ * keep the revision for picking the tuning container. An absent sensor
+ * is the common case here, so the ID and the revision go out as one
+ * plain i2c_transfer(), without the retries and bus recovery of
+ * ov5640_i2c_transfer().
+ */
+static int ov5640_read_chip_id(struct v4l2_subdev *sd)
+{
 	struct i2c_client *client = v4l2_get_subdevdata(sd);
-	int ret =0;
-
-	u8 chip_id_high_byte = 0;
-        ret = ov5640_reg_read(sd, 0x300A, &chip_id_high_byte);
-        if (ret) {
-                dev_err(&client->dev, "Failure to detect OV5640 chip_id_high_byte\n");
+	struct s5k4ba_state *state = to_state(sd);
+	u8 id_addr[2] = { OV5640_REG_CHIP_ID >> 8, OV5640_REG_CHIP_ID & 0xff };
+	u8 rev_addr[2] = { OV5640_REG_REVISION >> 8,
+			OV5640_REG_REVISION & 0xff };
+	u8 id[2];
+	struct i2c_msg msg[4] = {
+		{ .addr = client->addr, .flags = 0, .len = 2, .buf = id_addr },
+		{ .addr = client->addr, .flags = I2C_M_RD, .len = 2, .buf = id },
+		{ .addr = client->addr, .flags = 0, .len = 2, .buf = rev_addr },
+		{ .addr = client->addr, .flags = I2C_M_RD, .len = 1,
+			.buf = &state->revision },
+	};
+	u16 chip_id;
+	int ret;
+
+	mutex_lock(&state->bus_lock);
+	ret = i2c_transfer(client->adapter, msg, ARRAY_SIZE(msg));
+	mutex_unlock(&state->bus_lock);
+	atomic_inc(&state->stats.transfers);
+	if (ret != ARRAY_SIZE(msg)) {
+		atomic_inc(&state->stats.errors);
+		return ret < 0 ? ret : -EIO;
+	}
+	chip_id = (id[0] << 8) | id[1];
 
-        }
-        //chip_id_high_byte &= 0xF;
+	if (chip_id != OV5640_CHIP_ID) {
+		dev_err(&client->dev, "unexpected chip id 0x%04x\n", chip_id);
+		return -ENODEV;
+	}
 
-        dev_info(&client->dev, "Detected a OV5640 chip_id_high_byte_lower 4 bit  %x\n",
-                 chip_id_high_byte);
+	dev_info(&client->dev, "Detected a OV5640 chip, revision %x\n",
+		state->revision);
+	state->chip_checked = true;
 	return 0;
 }
 
@@ -2237,75 +5066,287 @@ static void ov5640_init_parameters(struct v4l2_subdev *sd)
         state->fw.major = 1;
 
         state->one_frame_delay_ms = NORMAL_MODE_MAX_ONE_FRAME_DELAY_MS;
+        state->pclk_khz = ov5640_pclk_khz(state, OV5640_PREVIEW_PCLK_KHZ);
 }
 
 
 
+/*
+ * Background half of ov5640_init(sd, 0). The base configuration goes
+ * first and releases the open path through base_done; the AF firmware
+ * upload and post-config follow and signal af_ready, which only AF
+ * requests wait for.
+ */
+static void ov5640_init_work(struct work_struct *work)
+{
+	struct s5k4ba_state *state =
+		container_of(work, struct s5k4ba_state, init_work);
+	struct v4l2_subdev *sd = &state->sd;
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	int err;
+
+	ov5640_tuning_load(sd);
+
+	/*
+	 * The base config rewrites the shadow and the run mode s_ctrl works
+	 * on. Everybody waits for base_done before taking ctrl_lock, so it
+	 * may be held across the whole push.
+	 */
+	mutex_lock(&state->ctrl_lock);
+	err = ov5640_tuning_run(sd, OV5640_TUNING_INIT);
+	if (err == -ENOENT)
+		err = ov540_block_writes(sd, configscript_common1,
+					ARRAY_SIZE(configscript_common1));
+	if (err)
+		dev_err(&client->dev, "%s: base register set failed\n",
+			__func__);
+	else
+		ov5640_set_runmode(state, S5K4BA_RUNMODE_IDLE);
+
+	state->base_err = err;
+	complete_all(&state->base_done);
+	mutex_unlock(&state->ctrl_lock);
+
+	/*
+	 * The AF image and its boot registers are only touched by AF
+	 * requests, and those wait for af_ready, so the upload runs
+	 * without ctrl_lock and s_ctrl stays responsive meanwhile
+	 */
+	if (!err) {
+		//err = OV5640_CAMERA_Module_AF_Init(sd); //old byte by byte write function , not in use.
+		err = ov5640_firmware_download_af(sd);
+		if (err)
+			dev_err(&client->dev, "%s: OV5640 AF init failed\n",
+				__func__);
+	}
+
+	state->af_err = err;
+	complete_all(&state->af_ready);
+
+	/*
+	 * Only after the completion: AF requests wait for it with ctrl_lock
+	 * held. An AF command that got in first keeps its state.
+	 */
+	if (!err) {
+		mutex_lock(&state->ctrl_lock);
+		if (state->af_status == AF_NONE)
+			ov5640_set_af_status(state, AF_INITIAL);
+		mutex_unlock(&state->ctrl_lock);
+	}
+	ov5640_dbg(sd, OV5640_DBG_MODE, "%s: done, err %d\n", __func__, err);
+}
+
 static int ov5640_init(struct v4l2_subdev *sd, u32 val)
 {
 	struct i2c_client *client = v4l2_get_subdevdata(sd);
 	struct s5k4ba_state *state =
                 container_of(sd, struct s5k4ba_state, sd);
-	int err = -EINVAL, i;
+	ktime_t start = ktime_get();
 
 	int ret = 0; 
 
 	v4l_info(client, "%s: camera initialization start\n", __func__);
 
-/*	ov5640_read_chip_id(sd );
-	u8 revision = 0;
-	ret = ov5640_reg_read(sd, 0x302A, &revision);
-        if (ret) {
-                dev_err(&client->dev, "Failure to detect OV5640 chip\n");
-                
-        }
-	//revision &= 0xF;
-
-        dev_info(&client->dev, "Detected a OV5640 chip, revision %x\n",
-                 revision); 
-*/ 
 	if(val == 0 ) { 
+		/* a previous pipeline must be done before restarting it */
+		flush_work(&state->init_work);
+
+		if (!state->chip_checked) {
+			ret = ov5640_read_chip_id(sd);
+			if (ret) {
+				dev_err(&client->dev, "no sensor answers at 0x%02x\n",
+					client->addr);
+				return -ENODEV;
+			}
+		}
+		state->active.mode = NULL;
+		state->zsl = false;
+		cancel_work_sync(&state->zsl_work);
+		state->bracket = false;
+		cancel_work_sync(&state->bracket_work);
+
 		ov5640_init_parameters(sd);
-		//ret = ov5640_reg_writes(sd, configscript_common1,
-              	//	ARRAY_SIZE(configscript_common1));
-		ret = ov540_block_writes(sd, configscript_common1,
-                        ARRAY_SIZE(configscript_common1));
-        	if (ret){
-			printk(" OV5640 i2c register setting failed ....");	
-		} 
-	
-		
-        	//err = OV5640_CAMERA_Module_AF_Init(sd); //old byte by byte write function , not in use. 
+		state->capture_armed = false;
+		state->af_continuous = false;
+		/* the base config runs AEC and AWB */
+		state->userset.ae_lock = 0;
+		state->userset.awb_lock = 0;
+		state->userset.auto_wb = 1;
+		state->userset.wb_temp = 0;
+		ov5640_ctrl_publish(state);
+		init_completion(&state->base_done);
+		init_completion(&state->af_ready);
+
+		mutex_lock(&state->ctrl_lock);
+		ov5640_set_runmode(state, S5K4BA_RUNMODE_NOTREADY);
+		ov5640_set_af_status(state, AF_NONE);
+		mutex_unlock(&state->ctrl_lock);
+		queue_work(state->wq, &state->init_work);
 
-		err = ov5640_firmware_download_af(sd);
-        	if(err){
-                	printk("\n OV5640 AF init failed");
-                	return err;
-        	}	
-        	state->af_status = AF_INITIAL;
-        	printk("%s: af_status set to start\n", __func__); 
+		/* preview may start once the base config is on the sensor */
+		wait_for_completion(&state->base_done);
+		ov5640_stats_latency(state, OV5640_LAT_INIT, start);
+		return state->base_err;
 
 	} else {
-		printk("\n regset_vga_preview : restoring preview"); 
-		//ret = ov5640_reg_writes(sd, regset_vga_preview,
-              	//			ARRAY_SIZE(regset_vga_preview));
-		ret = ov540_block_writes(sd, regset_vga_preview,
-                                        ARRAY_SIZE(regset_vga_preview));
-	        if (ret){
-        	        printk(" OV5640 i2c : regset_vga_preview restore fail.....");
-        	} 
+		ov5640_dbg(sd, OV5640_DBG_MODE, "%s: restoring preview\n", __func__);
+		wait_for_completion(&state->base_done);
+		/*
+		 * Only recorded, s_stream(1) flushes it. ZSL keeps streaming
+		 * full resolution across captures.
+		 */
+		if (!state->zsl && !state->is_mipi)
+			state->pending.mode = OV5640_MODE_PREVIEW;
 	} 
 	
 	return 0;
 }
 
+static const struct ov5640_mode *ov5640_get_modes(struct s5k4ba_state *state,
+						int *num)
+{
+	if (state->is_mipi) {
+		*num = ARRAY_SIZE(ov5640_mipi_modes);
+		return ov5640_mipi_modes;
+	}
+	*num = ARRAY_SIZE(ov5640_dvp_modes);
+	return ov5640_dvp_modes;
+}
+
+/*
+ * Mode for a requested size: the exact match if @exact, else the smallest
+ * mode covering it, falling back to the largest one.
+ */
+static const struct ov5640_mode *ov5640_find_mode(struct s5k4ba_state *state,
+						u32 width, u32 height,
+						bool exact)
+{
+	const struct ov5640_mode *modes;
+	int i, num;
+
+	modes = ov5640_get_modes(state, &num);
+	for (i = 0; i < num; i++) {
+		if (modes[i].width == width && modes[i].height == height)
+			return &modes[i];
+		if (!exact && modes[i].width >= width &&
+				modes[i].height >= height)
+			return &modes[i];
+	}
+	return exact ? NULL : &modes[num - 1];
+}
+
+static void ov5640_fill_fmt(const struct ov5640_mode *mode,
+				struct v4l2_mbus_framefmt *fmt)
+{
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->width = mode->width;
+	fmt->height = mode->height;
+	fmt->code = OV5640_MBUS_CODE;
+	fmt->field = V4L2_FIELD_NONE;
+	fmt->colorspace = V4L2_COLORSPACE_SRGB;
+}
+
+/* start or stop the MIPI transmitter, LP11 on the lanes while stopped */
+static int ov5640_mipi_stream(struct v4l2_subdev *sd, int enable)
+{
+	int err;
+
+	err = ov5640_reg_write(sd, OV5640_REG_MIPI_CTRL00, enable ? 0x04 : 0x24);
+	if (!err)
+		err = ov5640_reg_write(sd, OV5640_REG_FRAME_CTRL01,
+					enable ? 0x00 : 0x0f);
+	return err;
+}
+
+static int ov5640_enum_mbus_code(struct v4l2_subdev *sd,
+				struct v4l2_subdev_fh *fh,
+				struct v4l2_subdev_mbus_code_enum *code)
+{
+	if (code->pad || code->index)
+		return -EINVAL;
+
+	code->code = OV5640_MBUS_CODE;
+	return 0;
+}
+
+static int ov5640_enum_frame_size(struct v4l2_subdev *sd,
+				struct v4l2_subdev_fh *fh,
+				struct v4l2_subdev_frame_size_enum *fse)
+{
+	const struct ov5640_mode *modes;
+	int num;
+
+	modes = ov5640_get_modes(to_state(sd), &num);
+	if (fse->pad || fse->code != OV5640_MBUS_CODE || fse->index >= num)
+		return -EINVAL;
+
+	fse->min_width = fse->max_width = modes[fse->index].width;
+	fse->min_height = fse->max_height = modes[fse->index].height;
+	return 0;
+}
+
+static struct v4l2_mbus_framefmt *
+ov5640_pad_format(struct s5k4ba_state *state, struct v4l2_subdev_fh *fh,
+		u32 which)
+{
+	if (which == V4L2_SUBDEV_FORMAT_ACTIVE)
+		return &state->fmt;
+#ifdef CONFIG_VIDEO_V4L2_SUBDEV_API
+	return fh ? v4l2_subdev_get_try_format(fh, 0) : NULL;
+#else
+	return NULL;
+#endif
+}
+
+static int ov5640_get_fmt(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh,
+			struct v4l2_subdev_format *format)
+{
+	struct v4l2_mbus_framefmt *fmt;
+
+	fmt = ov5640_pad_format(to_state(sd), fh, format->which);
+	if (format->pad || !fmt)
+		return -EINVAL;
+
+	format->format = *fmt;
+	return 0;
+}
+
+/*
+ * Only the TRY format or the software state is touched here, the active
+ * mode reaches the sensor at s_stream(1).
+ */
+static int ov5640_set_fmt(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh,
+			struct v4l2_subdev_format *format)
+{
+	struct s5k4ba_state *state = to_state(sd);
+	const struct ov5640_mode *mode;
+	struct v4l2_mbus_framefmt *fmt;
+
+	fmt = ov5640_pad_format(state, fh, format->which);
+	if (format->pad || !fmt)
+		return -EINVAL;
+
+	mode = ov5640_find_mode(state, format->format.width,
+				format->format.height, false);
+	ov5640_fill_fmt(mode, &format->format);
+	*fmt = format->format;
+
+	if (format->which == V4L2_SUBDEV_FORMAT_ACTIVE) {
+		state->pending.mode = mode;
+		state->pix.width = mode->width;
+		state->pix.height = mode->height;
+	}
+	return 0;
+}
+
 static int ov5640_s_fmt(struct v4l2_subdev *sd, struct v4l2_mbus_framefmt *fmt)
 {
 	struct s5k4ba_state *state =
                 container_of(sd, struct s5k4ba_state, sd);
+	const struct ov5640_mode *mode;
         struct i2c_client *client = v4l2_get_subdevdata(sd);
 
-        dev_err(&client->dev, "%s: code = 0x%x, field = 0x%x,"
+        ov5640_dbg(sd, OV5640_DBG_MODE, "%s: code = 0x%x, field = 0x%x,"
                 " colorspace = 0x%x, width = %d, height = %d\n",
                 __func__, fmt->code, fmt->field,
                 fmt->colorspace,
@@ -2321,6 +5362,12 @@ static int ov5640_s_fmt(struct v4l2_subdev *sd, struct v4l2_mbus_framefmt *fmt)
 
 	state->pix.width = fmt->width;
         state->pix.height = fmt->height;
+	mode = state->is_mipi ?
+		ov5640_find_mode(state, fmt->width, fmt->height, true) : NULL;
+	if (mode) {
+		state->pending.mode = mode;
+		ov5640_fill_fmt(mode, &state->fmt);
+	}
         if (fmt->colorspace == V4L2_COLORSPACE_JPEG)
                 state->pix.pixelformat = V4L2_PIX_FMT_JPEG;
         else
@@ -2357,9 +5404,61 @@ static int ov5640_s_fmt(struct v4l2_subdev *sd, struct v4l2_mbus_framefmt *fmt)
 
 static int ov5640_s_stream(struct v4l2_subdev *sd, int enable)
 {
-        return 0;
+	struct s5k4ba_state *state = to_state(sd);
+	ktime_t start = ktime_get();
+	int err = 0;
+
+	if (enable) {
+		wait_for_completion(&state->base_done);
+		mutex_lock(&state->ctrl_lock);
+		err = ov5640_flush_config(sd);
+		mutex_unlock(&state->ctrl_lock);
+		ov5640_stats_latency(state, OV5640_LAT_PREVIEW, start);
+	} else {
+		ov5640_bracket_stop(sd);
+	}
+	if (!err && state->is_mipi)
+		err = ov5640_mipi_stream(sd, enable);
+	return err;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 2, 0)
+static int ov5640_g_mbus_config(struct v4l2_subdev *sd,
+				struct v4l2_mbus_config *cfg)
+{
+	struct s5k4ba_state *state = to_state(sd);
+
+	if (state->is_mipi) {
+		cfg->type = V4L2_MBUS_CSI2;
+		cfg->flags = V4L2_MBUS_CSI2_2_LANE | V4L2_MBUS_CSI2_CHANNEL_0 |
+			V4L2_MBUS_CSI2_CONTINUOUS_CLOCK;
+	} else {
+		cfg->type = V4L2_MBUS_PARALLEL;
+		cfg->flags = V4L2_MBUS_MASTER | V4L2_MBUS_HSYNC_ACTIVE_HIGH |
+			V4L2_MBUS_VSYNC_ACTIVE_HIGH |
+			V4L2_MBUS_PCLK_SAMPLE_RISING |
+			V4L2_MBUS_DATA_ACTIVE_HIGH;
+	}
+	return 0;
 }
+#endif
+
 
+static long ov5640_ioctl(struct v4l2_subdev *sd, unsigned int cmd, void *arg)
+{
+	switch (cmd) {
+	case VIDIOC_OV5640_G_ZSL_META:
+		return ov5640_get_zsl_meta(sd, arg);
+	case VIDIOC_OV5640_S_BRACKET:
+		return ov5640_set_bracket(sd, arg);
+	case VIDIOC_OV5640_G_BRACKET_META:
+		return ov5640_get_bracket_meta(sd, arg);
+	case OV5640_FRAME_END:
+		return ov5640_frame_end(sd, arg);
+	default:
+		return -ENOIOCTLCMD;
+	}
+}
 
 static const struct v4l2_subdev_core_ops ov5640_core_ops = {
 	.init = ov5640_init,	/* initializing API */
@@ -2367,6 +5466,7 @@ static const struct v4l2_subdev_core_ops ov5640_core_ops = {
 	.querymenu = s5k4ba_querymenu,
 	.g_ctrl = ov5640_g_ctrl,
 	.s_ctrl = ov5640_s_ctrl,
+	.ioctl = ov5640_ioctl,
 };
 
 static const struct v4l2_subdev_video_ops ov5640_video_ops = {
@@ -2377,13 +5477,138 @@ static const struct v4l2_subdev_video_ops ov5640_video_ops = {
 	.g_parm = ov5640_g_parm,
 	.s_parm = ov5640_s_parm,
 	.s_stream = ov5640_s_stream,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 2, 0)
+	.g_mbus_config = ov5640_g_mbus_config,
+#endif
+};
+
+static const struct v4l2_subdev_pad_ops ov5640_pad_ops = {
+	.enum_mbus_code = ov5640_enum_mbus_code,
+	.enum_frame_size = ov5640_enum_frame_size,
+	.get_fmt = ov5640_get_fmt,
+	.set_fmt = ov5640_set_fmt,
 };
 
 static const struct v4l2_subdev_ops ov5640_ops = {
 	.core = &ov5640_core_ops,
 	.video = &ov5640_video_ops,
+	.pad = &ov5640_pad_ops,
+};
+
+#ifdef CONFIG_VIDEO_V4L2_SUBDEV_API
+/* a new file handle starts with the default mode as its TRY format */
+static int ov5640_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
+{
+	ov5640_fill_fmt(ov5640_find_mode(to_state(sd), 0, 0, false),
+			v4l2_subdev_get_try_format(fh, 0));
+	return 0;
+}
+
+static const struct v4l2_subdev_internal_ops ov5640_internal_ops = {
+	.open = ov5640_open,
+};
+#endif
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *ov5640_debugfs_root;
+
+static const char * const ov5640_latency_names[OV5640_LAT_NUM] = {
+	[OV5640_LAT_INIT]	= "init",
+	[OV5640_LAT_PREVIEW]	= "preview_restore",
+	[OV5640_LAT_CAPTURE]	= "capture",
+	[OV5640_LAT_AF]		= "af_lock",
+	[OV5640_LAT_CTRL_LOCK]	= "s_ctrl_lock",
+};
+
+static int ov5640_stats_show(struct seq_file *m, void *unused)
+{
+	struct ov5640_stats *stats = m->private;
+
+	seq_printf(m, "transfers: %d\n", atomic_read(&stats->transfers));
+	seq_printf(m, "bytes: %ld\n", atomic_long_read(&stats->bytes));
+	seq_printf(m, "retries: %d\n", atomic_read(&stats->retries));
+	seq_printf(m, "errors: %d\n", atomic_read(&stats->errors));
+	seq_printf(m, "elided: %d\n", atomic_read(&stats->elided));
+	return 0;
+}
+
+/*
+ * One line per histogram: name followed by the bucket counts, bucket n
+ * holding samples of [2^(n-1), 2^n) us.
+ */
+static int ov5640_latency_show(struct seq_file *m, void *unused)
+{
+	struct ov5640_stats *stats = m->private;
+	int i, j;
+
+	for (i = 0; i < OV5640_LAT_NUM; i++) {
+		seq_printf(m, "%s:", ov5640_latency_names[i]);
+		for (j = 0; j < OV5640_HIST_BUCKETS; j++)
+			seq_printf(m, " %d", atomic_read(&stats->hist[i][j]));
+		seq_puts(m, "\n");
+	}
+	return 0;
+}
+
+static int ov5640_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ov5640_stats_show, inode->i_private);
+}
+
+static int ov5640_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ov5640_latency_show, inode->i_private);
+}
+
+static const struct file_operations ov5640_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= ov5640_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static const struct file_operations ov5640_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= ov5640_latency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
 };
 
+/* <debugfs>/ov5640/<i2c device name>/{stats,latency} */
+static void ov5640_debugfs_init(struct i2c_client *client,
+				struct s5k4ba_state *state)
+{
+	if (IS_ERR_OR_NULL(ov5640_debugfs_root))
+		return;
+
+	state->debugfs_dir = debugfs_create_dir(dev_name(&client->dev),
+						ov5640_debugfs_root);
+	if (IS_ERR_OR_NULL(state->debugfs_dir))
+		return;
+
+	debugfs_create_file("stats", S_IRUGO, state->debugfs_dir,
+				&state->stats, &ov5640_stats_fops);
+	debugfs_create_file("latency", S_IRUGO, state->debugfs_dir,
+				&state->stats, &ov5640_latency_fops);
+}
+
+static void ov5640_debugfs_remove(struct s5k4ba_state *state)
+{
+	debugfs_remove_recursive(state->debugfs_dir);
+}
+#else
+static inline void ov5640_debugfs_init(struct i2c_client *client,
+				struct s5k4ba_state *state)
+{
+}
+
+static inline void ov5640_debugfs_remove(struct s5k4ba_state *state)
+{
+}
+#endif
+
 /*
  * ov5640_probe
  * Fetching platform data is being done with s_config subdev call.
@@ -2394,12 +5619,46 @@ static int ov5640_probe(struct i2c_client *client,
 {
 	struct s5k4ba_state *state;
 	struct v4l2_subdev *sd;
+	int ret = -ENOMEM;
 
 	state = kzalloc(sizeof(struct s5k4ba_state), GFP_KERNEL);
 	if (state == NULL)
 		return -ENOMEM;
 
 	mutex_init(&state->ctrl_lock);
+	mutex_init(&state->bus_lock);
+	mutex_init(&state->group_lock);
+	seqlock_init(&state->ctrl_seq);
+	state->userset.banding = OV5640_POWER_LINE_MAX;
+	state->pdata = client->dev.platform_data;
+	if (state->pdata)
+		state->is_mipi = state->pdata->is_mipi;
+	ov5640_set_mclk(state, OV5640_PLL_REF_KHZ);
+	if (state->pdata && state->pdata->freq &&
+			ov5640_set_mclk(state, state->pdata->freq / 1000))
+		dev_warn(&client->dev, "MCLK %d Hz out of range, assuming %d kHz\n",
+			state->pdata->freq, OV5640_PLL_REF_KHZ);
+
+	state->shadow = kzalloc(sizeof(*state->shadow), GFP_KERNEL);
+	state->capture = kzalloc(sizeof(*state->capture), GFP_KERNEL);
+	if (!state->shadow || !state->capture)
+		goto err_free;
+
+	state->wq = create_singlethread_workqueue(S5K4BA_DRIVER_NAME);
+	if (!state->wq)
+		goto err_free;
+	INIT_WORK(&state->init_work, ov5640_init_work);
+	INIT_WORK(&state->zsl_work, ov5640_zsl_work);
+	spin_lock_init(&state->zsl_lock);
+	spin_lock_init(&state->af_lock);
+	INIT_WORK(&state->bracket_work, ov5640_bracket_work);
+	spin_lock_init(&state->bracket_lock);
+	/* nothing to wait for until the first ov5640_init(sd, 0) */
+	init_completion(&state->base_done);
+	init_completion(&state->af_ready);
+	state->base_err = state->af_err = -EAGAIN;
+	complete_all(&state->base_done);
+	complete_all(&state->af_ready);
 
 	sd = &state->sd;
 	strcpy(sd->name, S5K4BA_DRIVER_NAME);
@@ -2409,18 +5668,63 @@ static int ov5640_probe(struct i2c_client *client,
 
 	/* Registering subdev */
 	v4l2_i2c_subdev_init(sd, client, &ov5640_ops);
-	printk("%s\n", __func__);
+	/*
+	 * The host powers the sensor and runs MCLK around init(), so at probe
+	 * it may not answer yet; only a wrong chip id is final here
+	 */
+	ret = ov5640_read_chip_id(sd);
+	if (ret == -ENODEV)
+		goto err_wq;
+	if (ret)
+		dev_info(&client->dev, "no answer at 0x%02x, chip id is checked at power-up\n",
+			client->addr);
+	ov5640_fill_fmt(ov5640_find_mode(state, 0, 0, false), &state->fmt);
+#ifdef CONFIG_VIDEO_V4L2_SUBDEV_API
+	sd->internal_ops = &ov5640_internal_ops;
+#endif
+#ifdef CONFIG_MEDIA_CONTROLLER
+	sd->flags |= V4L2_SUBDEV_FL_HAS_DEVNODE;
+	state->pad.flags = MEDIA_PAD_FL_SOURCE;
+	sd->entity.type = MEDIA_ENT_T_V4L2_SUBDEV_SENSOR;
+	ret = media_entity_init(&sd->entity, 1, &state->pad, 0);
+	if (ret)
+		goto err_wq;
+#endif
+	ov5640_debugfs_init(client, state);
 	dev_info(&client->dev, "ov5640 has been probed\n");
 	return 0;
+
+err_wq:
+	destroy_workqueue(state->wq);
+err_free:
+	kfree(state->capture);
+	kfree(state->shadow);
+	kfree(state);
+	return ret;
 }
 
 
 static int ov5640_remove(struct i2c_client *client)
 {
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
+	struct s5k4ba_state *state = to_state(sd);
 
+	ov5640_debugfs_remove(state);
 	v4l2_device_unregister_subdev(sd);
+#ifdef CONFIG_MEDIA_CONTROLLER
+	media_entity_cleanup(&sd->entity);
+#endif
+	state->zsl = false;
+	cancel_work_sync(&state->zsl_work);
+	state->bracket = false;
+	cancel_work_sync(&state->bracket_work);
+	destroy_workqueue(state->wq);
 	mutex_destroy(&state->ctrl_lock);
+	mutex_destroy(&state->bus_lock);
+	mutex_destroy(&state->group_lock);
+	kfree(state->tuning_recs);
+	kfree(state->capture);
+	kfree(state->shadow);
 	kfree(to_state(sd));
 	return 0;
 }
@@ -2442,12 +5746,25 @@ static struct i2c_driver ov5640_i2c_driver = {
 
 static int __init ov5640_mod_init(void)
 {
-	return i2c_add_driver(&ov5640_i2c_driver);
+	int ret;
+
+#ifdef CONFIG_DEBUG_FS
+	ov5640_debugfs_root = debugfs_create_dir("ov5640", NULL);
+#endif
+	ret = i2c_add_driver(&ov5640_i2c_driver);
+#ifdef CONFIG_DEBUG_FS
+	if (ret)
+		debugfs_remove_recursive(ov5640_debugfs_root);
+#endif
+	return ret;
 }
 
 static void __exit ov5640_mod_exit(void)
 {
 	i2c_del_driver(&ov5640_i2c_driver);
+#ifdef CONFIG_DEBUG_FS
+	debugfs_remove_recursive(ov5640_debugfs_root);
+#endif
 }
 module_init(ov5640_mod_init);
 module_exit(ov5640_mod_exit);
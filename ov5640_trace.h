@@ -0,0 +1,167 @@
+/* linux/drivers/media/video/ov5640_trace.h
+ *
+ * Tracepoints for the Ominivision OV5640 camera sensor driver.
+ *
+ * Register traffic, explicit delays, run mode and AF state changes can be
+ * followed with ftrace/perf under the "ov5640" trace system, e.g.
+ *	echo 1 > /sys/kernel/debug/tracing/events/ov5640/enable
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ov5640
+
+#if !defined(_OV5640_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _OV5640_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* values of enum s5k4ba_runmode */
+#define show_ov5640_runmode(mode)				\
+	__print_symbolic(mode,					\
+		{ 0, "notready" },				\
+		{ 1, "idle" },					\
+		{ 2, "running" },				\
+		{ 3, "capture" })
+
+/* values of enum af_operation_status */
+#define show_ov5640_af_status(status)				\
+	__print_symbolic(status,				\
+		{ 0, "none" },					\
+		{ 1, "start" },					\
+		{ 2, "cancel" },				\
+		{ 3, "initial" })
+
+TRACE_EVENT(ov5640_reg_write,
+	TP_PROTO(u16 reg, u8 val),
+	TP_ARGS(reg, val),
+	TP_STRUCT__entry(
+		__field(u16, reg)
+		__field(u8, val)
+	),
+	TP_fast_assign(
+		__entry->reg = reg;
+		__entry->val = val;
+	),
+	TP_printk("reg=0x%04x val=0x%02x", __entry->reg, __entry->val)
+);
+
+/* the first (up to) four bytes read are recorded big-endian in @val */
+TRACE_EVENT(ov5640_reg_read,
+	TP_PROTO(u16 reg, const u8 *buf, u16 len),
+	TP_ARGS(reg, buf, len),
+	TP_STRUCT__entry(
+		__field(u16, reg)
+		__field(u16, len)
+		__field(u32, val)
+	),
+	TP_fast_assign(
+		int i;
+
+		__entry->reg = reg;
+		__entry->len = len;
+		__entry->val = 0;
+		for (i = 0; i < len && i < 4; i++)
+			__entry->val = (__entry->val << 8) | buf[i];
+	),
+	TP_printk("reg=0x%04x len=%u val=0x%x",
+		__entry->reg, __entry->len, __entry->val)
+);
+
+/* one auto-incrementing write message on the bus */
+TRACE_EVENT(ov5640_burst,
+	TP_PROTO(u16 reg, u16 len, int ret),
+	TP_ARGS(reg, len, ret),
+	TP_STRUCT__entry(
+		__field(u16, reg)
+		__field(u16, len)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->reg = reg;
+		__entry->len = len;
+		__entry->ret = ret;
+	),
+	TP_printk("reg=0x%04x len=%u ret=%d",
+		__entry->reg, __entry->len, __entry->ret)
+);
+
+/* @table is printed by symbol name, e.g. configscript_common1 */
+DECLARE_EVENT_CLASS(ov5640_table,
+	TP_PROTO(const void *table, int count),
+	TP_ARGS(table, count),
+	TP_STRUCT__entry(
+		__field(const void *, table)
+		__field(int, count)
+	),
+	TP_fast_assign(
+		__entry->table = table;
+		__entry->count = count;
+	),
+	TP_printk("%ps count=%d", __entry->table, __entry->count)
+);
+
+/* a register table push starts with @count entries ... */
+DEFINE_EVENT(ov5640_table, ov5640_table_start,
+	TP_PROTO(const void *table, int count),
+	TP_ARGS(table, count)
+);
+
+/* ... and ends, @count being the error code */
+DEFINE_EVENT(ov5640_table, ov5640_table_end,
+	TP_PROTO(const void *table, int count),
+	TP_ARGS(table, count)
+);
+
+TRACE_EVENT(ov5640_delay,
+	TP_PROTO(unsigned int us),
+	TP_ARGS(us),
+	TP_STRUCT__entry(
+		__field(unsigned int, us)
+	),
+	TP_fast_assign(
+		__entry->us = us;
+	),
+	TP_printk("us=%u", __entry->us)
+);
+
+TRACE_EVENT(ov5640_runmode,
+	TP_PROTO(int old, int new),
+	TP_ARGS(old, new),
+	TP_STRUCT__entry(
+		__field(int, old)
+		__field(int, new)
+	),
+	TP_fast_assign(
+		__entry->old = old;
+		__entry->new = new;
+	),
+	TP_printk("%s -> %s", show_ov5640_runmode(__entry->old),
+		show_ov5640_runmode(__entry->new))
+);
+
+TRACE_EVENT(ov5640_af_status,
+	TP_PROTO(int old, int new),
+	TP_ARGS(old, new),
+	TP_STRUCT__entry(
+		__field(int, old)
+		__field(int, new)
+	),
+	TP_fast_assign(
+		__entry->old = old;
+		__entry->new = new;
+	),
+	TP_printk("%s -> %s", show_ov5640_af_status(__entry->old),
+		show_ov5640_af_status(__entry->new))
+);
+
+#endif /* _OV5640_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE ov5640_trace
+#include <trace/define_trace.h>